@@ -17,10 +17,13 @@
 // [Config]             Configuration macros and settings
 // [Macros]             Basic macros
 // [Types]              Basic types and definitions
+// [Bits]               Bit manipulation helpers
 // [Library]            Library initialisation and shutdown
 // [Memory]             Memory management functions
 // [Array]              Dynamic array implementation
 // [Mutex]              Simple locking for resource protection
+// [Threads]            Threads and condition variables
+// [Thread pool]        Worker threads for running jobs in parallel
 // [Output]             Basic output to stdout and stderr
 // [Arena]              Memory management via arenas and paging
 // [Time]               Various cross-platform functions for handling time
@@ -212,6 +215,34 @@ typedef double f64; // 64-bit floating point
 
 typedef const char* cstr; // Constant string type
 
+//------------------------------------------------------------------------------[Bits]
+
+#if KORE_COMPILER_MSVC
+#    include <intrin.h>
+#endif // KORE_COMPILER_MSVC
+
+// Returns the number of trailing zero bits.  The value must not be zero.
+static inline u32 bits_ctz_u64(u64 value)
+{
+#if KORE_COMPILER_MSVC
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (u32)index;
+#else
+    return (u32)__builtin_ctzll(value);
+#endif
+}
+
+// Returns the number of set bits.
+static inline u32 bits_popcount_u64(u64 value)
+{
+#if KORE_COMPILER_MSVC
+    return (u32)__popcnt64(value);
+#else
+    return (u32)__builtin_popcountll(value);
+#endif
+}
+
 //------------------------------------------------------------------------------[Memory]
 
 #if defined(KORE_IMPLEMENTATION) || defined(KORE_TEST)
@@ -485,6 +516,78 @@ void mutex_done(Mutex* mutex);
 void mutex_lock(Mutex* mutex);
 void mutex_unlock(Mutex* mutex);
 
+//------------------------------------------------------------------------------[Threads]
+
+// In debug builds the tracking behind KORE_ALLOC is not thread safe, so
+// threads other than the main one should work in memory given to them, such
+// as their own arenas.
+
+typedef void (*ThreadFunc)(void* data);
+
+typedef struct {
+#if KORE_OS_WINDOWS
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    ThreadFunc func;
+    void*      data;
+} Thread;
+
+#if KORE_OS_WINDOWS
+typedef CONDITION_VARIABLE CondVar;
+#else
+typedef pthread_cond_t CondVar;
+#endif
+
+// Starts a thread running func(data).  The Thread must stay where it is until
+// the thread has been joined.  Returns false if the thread could not start.
+bool thread_start(Thread* thread, ThreadFunc func, void* data);
+void thread_join(Thread* thread);
+
+// Number of processors available to the process.
+usize cpu_count(void);
+
+void cond_init(CondVar* cond);
+void cond_done(CondVar* cond);
+void cond_wait(CondVar* cond, Mutex* mutex);
+void cond_signal(CondVar* cond);
+void cond_broadcast(CondVar* cond);
+
+//------------------------------------------------------------------------------[Thread pool]
+
+// A fixed set of worker threads that run batches of jobs.  The thread that
+// submits a batch works on it as well, and returns once every job in it has
+// finished.
+
+typedef void (*ThreadPoolFunc)(void* data, usize index);
+
+typedef struct {
+    Mutex          mutex;
+    CondVar        work_ready; // Signalled when a batch starts, or on shutdown
+    CondVar        work_done;  // Signalled when the last job of a batch ends
+    Thread*        threads;
+    usize          thread_count;
+    ThreadPoolFunc func;
+    void*          data;
+    usize          next_job; // Next job of the batch to hand out
+    usize          job_count;
+    usize          jobs_left; // Jobs of the batch that have not finished
+    bool           quit;
+} ThreadPool;
+
+// Starts `thread_count` worker threads.  With none, batches run entirely on
+// the submitting thread.
+void thread_pool_init(ThreadPool* pool, usize thread_count);
+void thread_pool_done(ThreadPool* pool);
+
+// Calls func(data, i) for every i in [0, count), spread over the workers and
+// the calling thread, and waits for them all to return.
+void thread_pool_run(ThreadPool*    pool,
+                     ThreadPoolFunc func,
+                     void*          data,
+                     usize          count);
+
 //------------------------------------------------------------------------------[Output]
 
 void prv(const char* format, va_list args);
@@ -1153,6 +1256,184 @@ void mutex_unlock(Mutex* mutex) { pthread_mutex_unlock(mutex); }
 
 #    endif // KORE_OS_WINDOWS
 
+//------------------------------------------------------------------------------[Threads]
+
+#    if KORE_OS_WINDOWS
+
+internal DWORD WINAPI _thread_entry(LPVOID arg)
+{
+    Thread* thread = (Thread*)arg;
+    thread->func(thread->data);
+    return 0;
+}
+
+bool thread_start(Thread* thread, ThreadFunc func, void* data)
+{
+    thread->func   = func;
+    thread->data   = data;
+    thread->handle = CreateThread(NULL, 0, _thread_entry, thread, 0, NULL);
+    return thread->handle != NULL;
+}
+
+void thread_join(Thread* thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+}
+
+usize cpu_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+void cond_init(CondVar* cond) { InitializeConditionVariable(cond); }
+
+void cond_done(CondVar* cond) { KORE_UNUSED(cond); }
+
+void cond_wait(CondVar* cond, Mutex* mutex)
+{
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+void cond_signal(CondVar* cond) { WakeConditionVariable(cond); }
+
+void cond_broadcast(CondVar* cond) { WakeAllConditionVariable(cond); }
+
+#    else // KORE_OS_POSIX
+
+internal void* _thread_entry(void* arg)
+{
+    Thread* thread = (Thread*)arg;
+    thread->func(thread->data);
+    return NULL;
+}
+
+bool thread_start(Thread* thread, ThreadFunc func, void* data)
+{
+    thread->func = func;
+    thread->data = data;
+    return pthread_create(&thread->handle, NULL, _thread_entry, thread) == 0;
+}
+
+void thread_join(Thread* thread) { pthread_join(thread->handle, NULL); }
+
+usize cpu_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (usize)count : 1;
+}
+
+void cond_init(CondVar* cond) { pthread_cond_init(cond, NULL); }
+
+void cond_done(CondVar* cond) { pthread_cond_destroy(cond); }
+
+void cond_wait(CondVar* cond, Mutex* mutex) { pthread_cond_wait(cond, mutex); }
+
+void cond_signal(CondVar* cond) { pthread_cond_signal(cond); }
+
+void cond_broadcast(CondVar* cond) { pthread_cond_broadcast(cond); }
+
+#    endif // KORE_OS_WINDOWS
+
+//------------------------------------------------------------------------------[Thread pool]
+
+// Runs jobs of the current batch until there are none left to hand out.  The
+// pool's mutex must be held, and is held again on return.
+internal void _thread_pool_work(ThreadPool* pool)
+{
+    while (pool->next_job < pool->job_count) {
+        usize index = pool->next_job++;
+        mutex_unlock(&pool->mutex);
+        pool->func(pool->data, index);
+        mutex_lock(&pool->mutex);
+
+        if (--pool->jobs_left == 0) {
+            cond_signal(&pool->work_done);
+        }
+    }
+}
+
+internal void _thread_pool_worker(void* data)
+{
+    ThreadPool* pool = (ThreadPool*)data;
+
+    mutex_lock(&pool->mutex);
+    while (!pool->quit) {
+        if (pool->next_job < pool->job_count) {
+            _thread_pool_work(pool);
+        } else {
+            cond_wait(&pool->work_ready, &pool->mutex);
+        }
+    }
+    mutex_unlock(&pool->mutex);
+}
+
+void thread_pool_init(ThreadPool* pool, usize thread_count)
+{
+    *pool = (ThreadPool){0};
+    mutex_init(&pool->mutex);
+    cond_init(&pool->work_ready);
+    cond_init(&pool->work_done);
+
+    if (thread_count == 0) {
+        return;
+    }
+
+    pool->threads = (Thread*)KORE_ALLOC(thread_count * sizeof(Thread));
+    for (usize i = 0; i < thread_count; ++i) {
+        if (!thread_start(&pool->threads[i], _thread_pool_worker, pool)) {
+            break;
+        }
+        pool->thread_count++;
+    }
+}
+
+void thread_pool_done(ThreadPool* pool)
+{
+    mutex_lock(&pool->mutex);
+    pool->quit = true;
+    cond_broadcast(&pool->work_ready);
+    mutex_unlock(&pool->mutex);
+
+    for (usize i = 0; i < pool->thread_count; ++i) {
+        thread_join(&pool->threads[i]);
+    }
+    if (pool->threads) {
+        KORE_FREE(pool->threads);
+    }
+
+    cond_done(&pool->work_done);
+    cond_done(&pool->work_ready);
+    mutex_done(&pool->mutex);
+    *pool = (ThreadPool){0};
+}
+
+void thread_pool_run(ThreadPool*    pool,
+                     ThreadPoolFunc func,
+                     void*          data,
+                     usize          count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    mutex_lock(&pool->mutex);
+    pool->func      = func;
+    pool->data      = data;
+    pool->next_job  = 0;
+    pool->job_count = count;
+    pool->jobs_left = count;
+    cond_broadcast(&pool->work_ready);
+
+    _thread_pool_work(pool);
+    while (pool->jobs_left > 0) {
+        cond_wait(&pool->work_done, &pool->mutex);
+    }
+    mutex_unlock(&pool->mutex);
+}
+
 //------------------------------------------------------------------------------[Output]
 
 internal cstr _format_output(cstr format, va_list args, usize* out_size)
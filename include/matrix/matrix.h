@@ -184,7 +184,7 @@ void matrix_render(Matrix* matrix, TermSize fb_size, TimePoint frame_start)
 
             usize glyph_index = (usize)(x * 37 + y * 17 + frame) % glyph_count;
             u32   glyph       = glyphs[glyph_index];
-            if (wcwidth(glyph) != 1) {
+            if (term_char_width(glyph) != 1) {
                 usize fallback_index =
                     (usize)(x * 11 + y * 23 + frame * 3) % glyph_narrow_count;
                 glyph = glyphs_narrow[fallback_index];
@@ -10,6 +10,7 @@
 //------------------------------------------------------------------------------
 
 #include <kore/kore.h>
+#include <kore/string.h>
 
 //------------------------------------------------------------------------------
 // Terminal information
@@ -30,28 +31,196 @@ typedef enum {
     TERM_EVENT_NONE,
     TERM_EVENT_KEY,
     TERM_EVENT_RESIZE,
+    TERM_EVENT_MOUSE,
+    TERM_EVENT_PASTE,
 } TermEventKind;
 
+// Key codes.  Keys that produce a character use its Unicode code point, and
+// the others are given codes beyond the Unicode range.
+typedef enum {
+    TERM_KEY_TAB       = 0x09,
+    TERM_KEY_ENTER     = 0x0D,
+    TERM_KEY_ESCAPE    = 0x1B,
+    TERM_KEY_BACKSPACE = 0x7F,
+
+    TERM_KEY_UP        = 0x110000,
+    TERM_KEY_DOWN,
+    TERM_KEY_RIGHT,
+    TERM_KEY_LEFT,
+    TERM_KEY_HOME,
+    TERM_KEY_END,
+    TERM_KEY_INSERT,
+    TERM_KEY_DELETE,
+    TERM_KEY_PAGE_UP,
+    TERM_KEY_PAGE_DOWN,
+    TERM_KEY_F1,
+    TERM_KEY_F2,
+    TERM_KEY_F3,
+    TERM_KEY_F4,
+    TERM_KEY_F5,
+    TERM_KEY_F6,
+    TERM_KEY_F7,
+    TERM_KEY_F8,
+    TERM_KEY_F9,
+    TERM_KEY_F10,
+    TERM_KEY_F11,
+    TERM_KEY_F12,
+} TermKey;
+
+// Modifier flags for keys and mouse events.
+enum {
+    TERM_MOD_SHIFT = 1 << 0,
+    TERM_MOD_ALT   = 1 << 1,
+    TERM_MOD_CTRL  = 1 << 2,
+    TERM_MOD_META  = 1 << 3,
+};
+
+typedef enum {
+    TERM_MOUSE_LEFT,
+    TERM_MOUSE_MIDDLE,
+    TERM_MOUSE_RIGHT,
+    TERM_MOUSE_NO_BUTTON, // Motion with no buttons held
+    TERM_MOUSE_WHEEL_UP,
+    TERM_MOUSE_WHEEL_DOWN,
+    TERM_MOUSE_WHEEL_LEFT,
+    TERM_MOUSE_WHEEL_RIGHT,
+} TermMouseButton;
+
+typedef enum {
+    TERM_MOUSE_PRESS,
+    TERM_MOUSE_RELEASE,
+    TERM_MOUSE_MOVE,
+    TERM_MOUSE_WHEEL,
+} TermMouseAction;
+
 typedef struct {
     TermEventKind kind;
     union {
-        char     key;
+        // TERM_EVENT_KEY
+        struct {
+            char key;       // The byte received for ASCII keys, otherwise 0
+            u32  code;      // Code point or TermKey
+            u8   modifiers; // TERM_MOD_* flags
+        };
+
+        // TERM_EVENT_RESIZE
         TermSize size;
+
+        // TERM_EVENT_MOUSE, in cell coordinates from the top-left
+        struct {
+            u16             x;
+            u16             y;
+            TermMouseButton button;
+            TermMouseAction action;
+            u8              modifiers;
+        } mouse;
+
+        // TERM_EVENT_PASTE, valid until the next term_loop() or term_wait()
+        struct {
+            const u8* text;
+            usize     length;
+        } paste;
     };
 } TermEvent;
 
+// How colours are sent to the terminal.  The reduced modes quantise each
+// colour to the nearest palette entry, which shrinks the output and works on
+// terminals without 24-bit colour support.
+typedef enum {
+    TERM_COLOUR_TRUE, // 24-bit colour
+    TERM_COLOUR_256,  // xterm 256 colour palette
+    TERM_COLOUR_16,   // ANSI 16 colours
+} TermColourMode;
+
+typedef struct {
+    TermColourMode colour_mode;
+
+    // Put stdout into non-blocking mode, waiting with poll() whenever the
+    // terminal cannot take more output.  Output from pr() and friends is not
+    // retried and may be cut short in this mode.
+    bool nonblocking_output;
+
+    // Report mouse presses, releases, drags and the wheel as mouse events.
+    bool mouse;
+
+    // Threads that term_fb_present may use to encode large frames, including
+    // the calling thread.  0 picks one per processor (up to 8), and 1 keeps
+    // all encoding on the calling thread.
+    u32 present_threads;
+
+    // Write frames on a background thread so that term_fb_present returns as
+    // soon as a frame is encoded.  If the terminal has not taken the previous
+    // frame yet, the new one is dropped and its changes go out with the next.
+    bool threaded_output;
+
+    // Run without a terminal, with a screen of this size.  See "Headless
+    // terminal" below.
+    TermSize headless_size;
+
+    // Also send every frame to any number of local clients through a Unix
+    // domain socket created at this path (POSIX only), such as the termcast
+    // tool.  Each frame is encoded once for all of them.  A client that
+    // attaches, or falls too far behind, is sent the whole screen.  REP is
+    // not used as the clients' terminals are unknown.
+    cstr broadcast_path;
+
+    // Record every frame sent to the terminal, with when it was sent, to a
+    // file at this path.  The whole screen is recorded as well every
+    // `record_keyframe_ms` milliseconds (2000 if 0).  See "Recordings" below.
+    cstr record_path;
+    u32  record_keyframe_ms;
+
+    // Frames per second that term_frame_begin and term_frame_end aim for (60
+    // if 0).  See "Frame pacing" below.
+    u32 frame_rate;
+} TermInitParams;
+
+// Pending events, held in a ring buffer whose capacity is a power of two.  It
+// only grows when it is full.
+typedef struct {
+    TermEvent* events;
+    u32        capacity;
+    u32        head; // Index of the oldest event
+    u32        count;
+} TermEventQueue;
+
 typedef struct Term {
-    TermSize size;
-    Array(TermEvent) event_queue;
-    bool initialised;
-    bool running;
+    TermSize       size;
+    TermEventQueue event_queue;
+    TermColourMode colour_mode;
+    bool           nonblocking_output;
+    bool           mouse;
+    u32            present_threads;
+    bool           threaded_output;
+    bool           headless;
+    cstr           broadcast_path;
+    cstr           record_path;
+    u32            record_keyframe_ms;
+    u32            frame_rate;
+    bool           rep;       // Runs of a character are sent with REP
+    bool           rep_probe; // Waiting for the reply to the REP probe
+    bool           initialised;
+    bool           running;
 } Term;
 
-void      term_init();
+void _term_init(TermInitParams params);
+
+#define term_init(...) _term_init((TermInitParams){__VA_ARGS__})
+
 void      term_done();
 bool      term_loop();
 TermEvent term_poll_event();
 
+// Removes up to `max` events from the queue into `out`, returning how many.
+usize term_poll_events(TermEvent* out, usize max);
+
+// Sleeps until there is input, the terminal resizes or the timeout expires,
+// then queues any events.  Returns true if there are events waiting.  It may
+// return early if interrupted by a signal.
+bool term_wait(TimeDuration timeout);
+
+#define TERM_WAIT_FOREVER ((TimeDuration)UINT64_MAX)
+
 void term_cursor_show();
 void term_cursor_hide();
 
@@ -96,8 +265,23 @@ void term_fb_rect_char(TermRect rect, u32 ch);
 // Character painting
 void term_fb_rect(TermRect rect, u32 ch, u32 ink, u32 paper);
 
+// Translucent colours.  These lay a colour made with term_rgba over the
+// colours already in a rectangle, weighted by its alpha, for popups that dim
+// what is behind them and highlights that fade.  An alpha of 255 replaces the
+// colours and 0 leaves them alone.  The characters are not changed.
+void term_fb_rect_blend(TermRect rect, u32 colour);
+void term_fb_blend_paper(TermRect rect, u32 colour);
+
+// Scrolling.  Moves the contents of a rectangle up by `dy` rows, or down if
+// `dy` is negative.  The exposed rows are cleared to spaces, keeping their
+// colours.  When the rectangle spans the full width of the framebuffer the
+// terminal is asked to do the scrolling, so the next present only sends the
+// exposed rows and any cells changed since.
+void term_fb_scroll(TermRect rect, int dy);
+
 // Writing strings
 void term_fb_write(u16 x, u16 y, cstr string);
+void term_fb_write_string(u16 x, u16 y, string text);
 void term_fb_formatv(u16 x, u16 y, cstr fmt, va_list args);
 void term_fb_format(u16 x, u16 y, cstr fmt, ...);
 
@@ -107,6 +291,229 @@ void term_fb_format(u16 x, u16 y, cstr fmt, ...);
 
 void term_fb_present();
 
+//
+// Canvases
+//
+// A canvas is an off-screen grid of cells with its own character, ink and
+// paper planes.  A panel that rarely changes can be drawn into a canvas only
+// when it does, and copied to the framebuffer with term_fb_blit every frame.
+// Wide characters are stored as in the framebuffer.
+//
+
+typedef struct {
+    u16  width;
+    u16  height;
+    u32* chars;
+    u32* ink;
+    u32* paper;
+} TermCanvas;
+
+// Allocates the canvas's planes from an arena, filled with spaces in black on
+// black.  The canvas lasts as long as the arena.
+void term_canvas_init(TermCanvas* canvas, Arena* arena, u16 width, u16 height);
+
+void term_canvas_cls(TermCanvas* canvas, u32 ink, u32 paper);
+void term_canvas_rect(
+    TermCanvas* canvas, TermRect rect, u32 ch, u32 ink, u32 paper);
+void term_canvas_rect_colour(TermCanvas* canvas,
+                             TermRect    rect,
+                             u32         ink,
+                             u32         paper);
+void term_canvas_write(TermCanvas* canvas, u16 x, u16 y, cstr string);
+void term_canvas_write_string(TermCanvas* canvas, u16 x, u16 y, string text);
+void term_canvas_format(TermCanvas* canvas, u16 x, u16 y, cstr fmt, ...);
+
+// Pixel images can be drawn into a canvas at a higher resolution than its
+// cells.  An image's top left pixel lands in the top left of cell (x, y), and
+// the image is clipped to the canvas.
+typedef enum {
+    TERM_PIXELS_ARGB, // Colours from term_rgb, 0xAARRGGBB
+    TERM_PIXELS_RGBA, // Bytes R, G, B, A in memory, as GfxLayer uses
+} TermPixelFormat;
+
+typedef struct {
+    const u32*      pixels;
+    u16             width;
+    u16             height;
+    usize           stride; // Pixels from one row to the next, 0 for width
+    TermPixelFormat format;
+} TermPixels;
+
+// Draws 1x2 pixels per cell with the upper half block, the top pixel being
+// the ink and the bottom one the paper.  A cell whose pixels match becomes a
+// space, so areas of flat colour are runs of identical cells that present
+// cheaply.  An odd last row of pixels is drawn over the existing paper.
+void term_canvas_half_blocks(TermCanvas* canvas,
+                             u16         x,
+                             u16         y,
+                             TermPixels  image);
+
+// Draws 2x4 pixels per cell with braille patterns.  Pixels that are not
+// black are set and drawn in `ink` on `paper`.  Cells with none set become
+// spaces.
+void term_canvas_braille(
+    TermCanvas* canvas, u16 x, u16 y, TermPixels image, u32 ink, u32 paper);
+
+// Copies part of a canvas to the framebuffer with its top left corner at
+// (x, y), clipped to both.  Rows that already match are not marked dirty, so
+// blitting an unchanged canvas over itself costs nothing to present.
+void term_fb_blit(const TermCanvas* canvas, TermRect src_rect, u16 x, u16 y);
+
+// Copies part of a canvas as term_fb_blit does, but laying its colours over
+// the framebuffer's by their alpha.  Each paper is blended over the paper
+// below.  Where the canvas has a space the character below is kept and its
+// ink is tinted by the canvas paper; elsewhere the canvas character replaces
+// it and its ink is blended over the ink below.  A freshly initialised canvas
+// is black with zero alpha, so the parts of it never drawn are invisible.
+void term_fb_blit_blend(const TermCanvas* canvas,
+                        TermRect          src_rect,
+                        u16               x,
+                        u16               y);
+
+//
+// Characters
+//
+
+// Returns the number of cells a character occupies: 1 or 2, 0 for combining
+// and other zero-width characters, and -1 for control characters.  Unlike
+// wcwidth() this does not depend on the process locale.
+int term_char_width(u32 ch);
+
+// Statistics about the frames sent by term_fb_present.
+typedef struct {
+    u64          frame_count;    // Number of frames that produced output
+    usize        frame_bytes;    // Bytes sent for the last frame
+    u64          total_bytes;    // Bytes sent for all frames
+    TimeDuration encode_time;    // Time spent encoding the last frame
+    TimeDuration write_time;     // Time spent writing the last frame
+    usize        dirty_cells;    // Cells examined for the last frame
+    u64          dropped_frames; // Frames skipped as the writer was busy
+    usize        clients;        // Clients attached to the broadcast socket
+    u64          keyframes;      // Whole screens sent to broadcast clients
+    f64          frame_rate;     // Frames per second term_frame_end allows
+    usize        output_backlog; // Bytes the terminal had not read yet
+} TermStats;
+
+TermStats term_stats(void);
+
+//------------------------------------------------------------------------------
+// Recordings
+//
+// With TermInitParams.record_path set, each frame term_fb_present sends is
+// appended to a file along with when it was sent.  From time to time, and
+// whenever the screen size changes, the whole screen is recorded too as a
+// keyframe, so that playback can start part way through.  The termreplay
+// tool plays recordings back.
+//
+// The file starts with the 7 bytes "TERMREC" and a version byte, 1.  Records
+// follow, each being:
+//
+//      u8      kind        TERM_RECORD_FRAME or TERM_RECORD_KEYFRAME
+//      varint  time        Microseconds since the previous record
+//      varint  size        Bytes of payload
+//      u8[]    payload
+//
+// A frame's payload is the bytes that were sent.  A keyframe's is the screen
+// width and height, as varints, then bytes that draw the screen as it was
+// after the previous frame.  Varints are unsigned LEB128: 7 bits at a time,
+// lowest first, with the top bit set on every byte but the last.
+//
+// Records are only ever appended, so a recording can be read while it is
+// being made.  They are buffered and written out at least at each keyframe.
+//------------------------------------------------------------------------------
+
+typedef enum {
+    TERM_RECORD_FRAME    = 1,
+    TERM_RECORD_KEYFRAME = 2,
+} TermRecordKind;
+
+typedef struct {
+    TermRecordKind kind;
+    u64            time_us; // Microseconds since the recording started
+    TermSize       size;    // The screen size, for keyframes
+    string         output;  // Bytes to send to a terminal
+} TermRecord;
+
+// Reads the records of a recording held in memory.  A reader can be copied
+// to come back to where it was.
+typedef struct {
+    string data;
+    usize  offset;
+    u64    time_us;
+} TermRecordReader;
+
+// Returns false if the data is not a recording.
+bool term_record_reader_init(TermRecordReader* reader, string data);
+
+// Reads the next record, returning false at the end.  A record that has been
+// cut short, as the last one may be while it is written, is the end too.
+bool term_record_next(TermRecordReader* reader, TermRecord* out_record);
+
+//------------------------------------------------------------------------------
+// Frame pacing
+//
+// For programs that animate, such as dashboards, a frame loop is:
+//
+//      while (term_loop()) {
+//          term_frame_begin();
+//          ... handle events and draw ...
+//          term_frame_end();
+//      }
+//
+// term_frame_begin sleeps until the next frame is due, but input or a resize
+// wakes it at once.  term_frame_end presents the frame and decides when the
+// next is due.  Frames start at TermInitParams.frame_rate, but when the
+// terminal cannot keep up (say over a slow link) they are spaced out, so that
+// its output queue does not fill with frames that are stale before they are
+// shown.  The rate recovers once the terminal catches up.
+//------------------------------------------------------------------------------
+
+// Returns true if there are events waiting.
+bool term_frame_begin(void);
+void term_frame_end(void);
+
+//------------------------------------------------------------------------------
+// Headless terminal
+//
+// With TermInitParams.headless_size set, no terminal is used at all.  The
+// screen has a fixed size, no input ever arrives (so term_wait just sleeps),
+// and everything the terminal would have been sent is kept in memory.  A
+// minimal VT parser applies that output to a shadow screen, which can be
+// checked against the framebuffer.  This lets term_fb_present be tested and
+// benchmarked without a tty.  Output from pr() still goes to stdout.
+//------------------------------------------------------------------------------
+
+enum {
+    TERM_HEADLESS_WIDE_TAIL = 0xFFFFFFFFu, // Right half of a wide character
+    TERM_HEADLESS_DEFAULT   = 0xFFFFFFFFu, // Colour never set by SGR
+};
+
+// A cell of the shadow screen.  Colours are as they were sent: 0xRRGGBB in
+// true colour mode, otherwise a palette index.
+typedef struct {
+    u32 ch;
+    u32 ink;
+    u32 paper;
+} TermHeadlessCell;
+
+// Everything sent to the terminal since the last clear.
+string term_headless_output(void);
+void   term_headless_clear_output(void);
+
+// Changes the screen size, queuing a resize event like a real terminal.
+void term_headless_resize(TermSize size);
+
+// Blanks the shadow screen and applies `output` to it, as if it were a second
+// terminal of the same size shown that output from the start.  This checks
+// streams sent elsewhere, such as to broadcast clients.
+void term_headless_replay(string output);
+
+TermHeadlessCell term_headless_cell(u16 x, u16 y);
+
+// Returns the number of cells where the shadow screen differs from the
+// framebuffer.  Straight after term_fb_present this should be 0.
+usize term_headless_verify(void);
+
 //------------------------------------------------------------------------------
 // Terminal information dumping
 //------------------------------------------------------------------------------
@@ -121,33 +528,219 @@ void dump_term_size();
 
 #ifdef KORE_IMPLEMENTATION
 
-#    include <locale.h>
-#    include <wchar.h>
+#    include <term/term_width.h>
+
+// SIMD support for the bulk framebuffer kernels.  The widest instruction set
+// enabled by the compiler is used, falling back to plain loops.
+#    define TERM_SIMD_AVX2 NO
+#    define TERM_SIMD_SSE2 NO
+
+#    if defined(__AVX2__)
+#        undef TERM_SIMD_AVX2
+#        define TERM_SIMD_AVX2 YES
+#    endif
+#    if defined(__SSE2__) || defined(_M_X64) ||                                \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#        undef TERM_SIMD_SSE2
+#        define TERM_SIMD_SSE2 YES
+#    endif
+
+#    if TERM_SIMD_AVX2
+#        include <immintrin.h>
+#    elif TERM_SIMD_SSE2
+#        include <emmintrin.h>
+#    endif
+
+global_variable Term      g_term;
+global_variable TermStats g_term_stats;
+global_variable bool      g_cursor_visible          = true;
+
+global_variable TermSize  g_term_fb_size            = {0};
+global_variable Arena     g_term_arena;
+
+// Whole screens for broadcast clients and recordings are encoded here, as the
+// terminal arena may still hold the frame they follow.
+global_variable Arena     g_term_screen_arena;
+
+// Cells that may have changed since the last present.  Each row has a bitset
+// of dirty cells (g_term_fb_dirty_words u64s long) and a span [x0, x1)
+// covering them.  A further bitset marks which rows have any dirty cells so
+// that presentation can skip clean rows entirely.
+global_variable Array(u64) g_term_fb_dirty          = NULL;
+global_variable Array(u16) g_term_fb_dirty_x0       = NULL;
+global_variable Array(u16) g_term_fb_dirty_x1       = NULL;
+global_variable Array(u64) g_term_fb_dirty_rows     = NULL;
+global_variable usize      g_term_fb_dirty_words    = 0;
+
+// The framebuffer is stored either as separate planes of characters, ink and
+// paper (the default), or with each cell's values interleaved in a TermCell
+// when TERM_FB_INTERLEAVED is defined to YES before the implementation is
+// included.  The rest of the implementation accesses cells through the
+// TERM_FB_* macros below so that it works with either layout.
+//
+// The front buffer holds the cells as they were last transmitted to the
+// terminal.  Presentation compares the back buffer against it so that only
+// cells that really changed are sent.
+//
+// All the planes of both buffers share one allocation, g_term_fb_block, with
+// room for g_term_fb_capacity cells in each.  The back buffer's planes come
+// first.
+#    ifndef TERM_FB_INTERLEAVED
+#        define TERM_FB_INTERLEAVED NO
+#    endif
+
+#    if TERM_FB_INTERLEAVED
+
+typedef struct {
+    u32 ch;
+    u32 ink;
+    u32 paper;
+    u32 flags; // Reserved, always 0 so whole cells can be compared
+} TermCell;
+
+global_variable TermCell* g_term_fb_cells       = NULL;
+global_variable TermCell* g_term_fb_front_cells = NULL;
+
+#        define TERM_FB_CELL_SIZE sizeof(TermCell)
+#        define TERM_FB_BACK_PLANES 1
+
+#        define TERM_FB_CH(i) (g_term_fb_cells[i].ch)
+#        define TERM_FB_INK(i) (g_term_fb_cells[i].ink)
+#        define TERM_FB_PAPER(i) (g_term_fb_cells[i].paper)
+#        define TERM_FB_FRONT_CH(i) (g_term_fb_front_cells[i].ch)
+
+#    else
+
+global_variable u32* g_term_fb_chars       = NULL;
+global_variable u32* g_term_fb_ink         = NULL;
+global_variable u32* g_term_fb_paper       = NULL;
+global_variable u32* g_term_fb_front_chars = NULL;
+global_variable u32* g_term_fb_front_ink   = NULL;
+global_variable u32* g_term_fb_front_paper = NULL;
+
+#        define TERM_FB_CELL_SIZE sizeof(u32)
+#        define TERM_FB_BACK_PLANES 3
+
+#        define TERM_FB_CH(i) (g_term_fb_chars[i])
+#        define TERM_FB_INK(i) (g_term_fb_ink[i])
+#        define TERM_FB_PAPER(i) (g_term_fb_paper[i])
+#        define TERM_FB_FRONT_CH(i) (g_term_fb_front_chars[i])
 
-global_variable Term g_term;
-global_variable bool g_cursor_visible               = true;
+#    endif // TERM_FB_INTERLEAVED
 
-global_variable          Array(u32) g_term_fb_chars = NULL;
-global_variable          Array(u32) g_term_fb_ink   = NULL;
-global_variable          Array(u32) g_term_fb_paper = NULL;
-global_variable          Array(u8) g_term_fb_dirty  = NULL;
-global_variable TermSize g_term_fb_size             = {0};
-global_variable Arena    g_term_arena;
+#    define TERM_FB_PLANES (TERM_FB_BACK_PLANES * 2)
 
-enum { TERM_FB_CHAR_WIDE_TAIL = 0xFFFFFFFFu };
+global_variable u8*   g_term_fb_block    = NULL;
+global_variable usize g_term_fb_capacity = 0;
+
+// A scroll of full width rows that the terminal performs at the next present.
+// The front buffer is scrolled when it is queued, so it already shows what
+// the terminal will after the scroll.
+typedef struct {
+    u16 top;    // First row of the scrolled region
+    u16 bottom; // One past the last row
+    i16 dy;     // Rows scrolled up, or down if negative
+} TermScroll;
+
+global_variable Array(TermScroll) g_term_fb_scrolls = NULL;
+
+enum {
+    TERM_FB_CHAR_WIDE_TAIL = 0xFFFFFFFFu,
+    TERM_FB_CHAR_INVALID   = 0xFFFFFFFEu, // Front cell with unknown contents
+};
+
+// Input decoder states.
+typedef enum {
+    TERM_INPUT_GROUND,
+    TERM_INPUT_UTF8,   // Within a multi-byte character
+    TERM_INPUT_ESCAPE, // After ESC
+    TERM_INPUT_CSI,    // After ESC [
+    TERM_INPUT_SS3,    // After ESC O
+    TERM_INPUT_PASTE,  // Within a bracketed paste
+} TermInputState;
+
+#    define TERM_INPUT_MAX_PARAMS 8
+
+typedef struct {
+    TermInputState state;
+    u32            params[TERM_INPUT_MAX_PARAMS];
+    u32            param_count;
+    u8             marker;         // Private marker of a CSI sequence, e.g. '<'
+    u8             modifiers;      // Alt if the key followed an ESC
+    u32            code;           // Character being decoded
+    u32            utf8_remaining; // Continuation bytes still to come
+    usize          paste_start;    // Offset of the paste in g_term_paste
+    usize          paste_match;    // Bytes of the paste terminator seen
+    TimePoint      read_time;      // When input was last read
+} TermInputDecoder;
+
+global_variable TermInputDecoder g_term_input;
+global_variable Array(u8) g_term_paste = NULL;
 
 internal void _term_queue_event(TermEvent event);
+internal void _term_input_decode(const u8* data, usize size);
+internal void _term_input_flush(void);
+internal void _term_input_ascii(u8 byte, u8 modifiers);
+internal void _term_output(const u8* data, usize size);
+internal void _term_output_parts(const string* parts, usize count);
+internal usize _term_output_backlog(void);
 internal void _term_alt_enter();
 internal void _term_alt_leave();
 internal void _term_raw_enter();
 internal void _term_raw_leave();
 
+// The parts of a cell written by _term_fb_fill_rect.
+enum {
+    TERM_FB_FILL_CH     = 1 << 0,
+    TERM_FB_FILL_INK    = 1 << 1,
+    TERM_FB_FILL_PAPER  = 1 << 2,
+    TERM_FB_FILL_COLOUR = TERM_FB_FILL_INK | TERM_FB_FILL_PAPER,
+    TERM_FB_FILL_ALL    = TERM_FB_FILL_CH | TERM_FB_FILL_COLOUR,
+};
+
 internal void _term_fb_resize(u16 width, u16 height);
 internal void _term_fb_done();
+internal void _term_fb_fill_rect(
+    TermRect clipped_rect, u32 fields, u32 ch, u32 ink, u32 paper);
+internal void _term_fb_invalidate_front(void);
+internal void _term_fb_invalidate_front_rows(u16 y, u16 rows);
+internal void _term_present_done(void);
+internal void _term_writer_start(void);
+internal void _term_writer_stop(void);
+internal void _term_writer_wait(void);
+internal void _term_broadcast_start(void);
+internal void _term_broadcast_stop(void);
+internal void _term_broadcast_frame(const string* parts, usize count);
+internal void _term_record_start(void);
+internal void _term_record_stop(void);
+internal void _term_record_frame(const string* parts, usize count);
+internal void _term_frame_reset(void);
+internal void _term_headless_start(void);
+internal void _term_headless_done(void);
+internal void _term_headless_capture(const u8* data, usize size);
+internal bool _term_headless_wait(TimeDuration timeout);
 
 internal void _term_start(void);
 internal void _term_stop(void);
 
+// Largest number of input bytes or console records read in one go.
+#    define TERM_INPUT_BUFFER_SIZE 4096
+
+// How long a lone ESC waits for the rest of a sequence before it is taken as
+// the Escape key.  Sequences can be split across reads, e.g. over ssh.
+#    define TERM_INPUT_ESCAPE_TIMEOUT_MS 25
+
+// Converts a timeout to the whole milliseconds used by the OS waits, rounding
+// up so that we never wake early and spin.  Returns -1 to wait forever.
+internal int _term_timeout_ms(TimeDuration timeout)
+{
+    if (timeout == TERM_WAIT_FOREVER) {
+        return -1;
+    }
+    u64 ms = (time_duration_to_us(timeout) + 999) / 1000;
+    return (int)KORE_MIN(ms, (u64)INT32_MAX);
+}
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 // WINDOWS IMPLEMENTATION
@@ -161,125 +754,13 @@ global_variable DWORD  g_term_console_input_mode    = 0;
 global_variable bool   g_term_console_mode_captured = false;
 
 //------------------------------------------------------------------------------
-// Windows implementation of wcwidth
-
-typedef struct {
-    int first;
-    int last;
-} TermInterval;
 
-internal int _term_bisearch(wchar_t ucs, const TermInterval* table, int max)
+TermSize term_size_get(void)
 {
-    int min = 0;
-    int mid;
-
-    if (ucs < table[0].first || ucs > table[max].last) {
-        return 0;
-    }
-    while (max >= min) {
-        mid = (min + max) / 2;
-        if (ucs > table[mid].last) {
-            min = mid + 1;
-        } else if (ucs < table[mid].first) {
-            max = mid - 1;
-        } else {
-            return 1;
-        }
-    }
-
-    return 0;
-}
-
-int wcwidth(u32 ucs)
-{
-    /* sorted list of non-overlapping intervals of non-spacing characters */
-    /* generated by "uniset +cat=Me +cat=Mn +cat=Cf -00AD +1160-11FF +200B c" */
-    static const TermInterval combining[] = {
-        {0x0300, 0x036F},   {0x0483, 0x0486},   {0x0488, 0x0489},
-        {0x0591, 0x05BD},   {0x05BF, 0x05BF},   {0x05C1, 0x05C2},
-        {0x05C4, 0x05C5},   {0x05C7, 0x05C7},   {0x0600, 0x0603},
-        {0x0610, 0x0615},   {0x064B, 0x065E},   {0x0670, 0x0670},
-        {0x06D6, 0x06E4},   {0x06E7, 0x06E8},   {0x06EA, 0x06ED},
-        {0x070F, 0x070F},   {0x0711, 0x0711},   {0x0730, 0x074A},
-        {0x07A6, 0x07B0},   {0x07EB, 0x07F3},   {0x0901, 0x0902},
-        {0x093C, 0x093C},   {0x0941, 0x0948},   {0x094D, 0x094D},
-        {0x0951, 0x0954},   {0x0962, 0x0963},   {0x0981, 0x0981},
-        {0x09BC, 0x09BC},   {0x09C1, 0x09C4},   {0x09CD, 0x09CD},
-        {0x09E2, 0x09E3},   {0x0A01, 0x0A02},   {0x0A3C, 0x0A3C},
-        {0x0A41, 0x0A42},   {0x0A47, 0x0A48},   {0x0A4B, 0x0A4D},
-        {0x0A70, 0x0A71},   {0x0A81, 0x0A82},   {0x0ABC, 0x0ABC},
-        {0x0AC1, 0x0AC5},   {0x0AC7, 0x0AC8},   {0x0ACD, 0x0ACD},
-        {0x0AE2, 0x0AE3},   {0x0B01, 0x0B01},   {0x0B3C, 0x0B3C},
-        {0x0B3F, 0x0B3F},   {0x0B41, 0x0B43},   {0x0B4D, 0x0B4D},
-        {0x0B56, 0x0B56},   {0x0B82, 0x0B82},   {0x0BC0, 0x0BC0},
-        {0x0BCD, 0x0BCD},   {0x0C3E, 0x0C40},   {0x0C46, 0x0C48},
-        {0x0C4A, 0x0C4D},   {0x0C55, 0x0C56},   {0x0CBC, 0x0CBC},
-        {0x0CBF, 0x0CBF},   {0x0CC6, 0x0CC6},   {0x0CCC, 0x0CCD},
-        {0x0CE2, 0x0CE3},   {0x0D41, 0x0D43},   {0x0D4D, 0x0D4D},
-        {0x0DCA, 0x0DCA},   {0x0DD2, 0x0DD4},   {0x0DD6, 0x0DD6},
-        {0x0E31, 0x0E31},   {0x0E34, 0x0E3A},   {0x0E47, 0x0E4E},
-        {0x0EB1, 0x0EB1},   {0x0EB4, 0x0EB9},   {0x0EBB, 0x0EBC},
-        {0x0EC8, 0x0ECD},   {0x0F18, 0x0F19},   {0x0F35, 0x0F35},
-        {0x0F37, 0x0F37},   {0x0F39, 0x0F39},   {0x0F71, 0x0F7E},
-        {0x0F80, 0x0F84},   {0x0F86, 0x0F87},   {0x0F90, 0x0F97},
-        {0x0F99, 0x0FBC},   {0x0FC6, 0x0FC6},   {0x102D, 0x1030},
-        {0x1032, 0x1032},   {0x1036, 0x1037},   {0x1039, 0x1039},
-        {0x1058, 0x1059},   {0x1160, 0x11FF},   {0x135F, 0x135F},
-        {0x1712, 0x1714},   {0x1732, 0x1734},   {0x1752, 0x1753},
-        {0x1772, 0x1773},   {0x17B4, 0x17B5},   {0x17B7, 0x17BD},
-        {0x17C6, 0x17C6},   {0x17C9, 0x17D3},   {0x17DD, 0x17DD},
-        {0x180B, 0x180D},   {0x18A9, 0x18A9},   {0x1920, 0x1922},
-        {0x1927, 0x1928},   {0x1932, 0x1932},   {0x1939, 0x193B},
-        {0x1A17, 0x1A18},   {0x1B00, 0x1B03},   {0x1B34, 0x1B34},
-        {0x1B36, 0x1B3A},   {0x1B3C, 0x1B3C},   {0x1B42, 0x1B42},
-        {0x1B6B, 0x1B73},   {0x1DC0, 0x1DCA},   {0x1DFE, 0x1DFF},
-        {0x200B, 0x200F},   {0x202A, 0x202E},   {0x2060, 0x2063},
-        {0x206A, 0x206F},   {0x20D0, 0x20EF},   {0x302A, 0x302F},
-        {0x3099, 0x309A},   {0xA806, 0xA806},   {0xA80B, 0xA80B},
-        {0xA825, 0xA826},   {0xFB1E, 0xFB1E},   {0xFE00, 0xFE0F},
-        {0xFE20, 0xFE23},   {0xFEFF, 0xFEFF},   {0xFFF9, 0xFFFB},
-        {0x10A01, 0x10A03}, {0x10A05, 0x10A06}, {0x10A0C, 0x10A0F},
-        {0x10A38, 0x10A3A}, {0x10A3F, 0x10A3F}, {0x1D167, 0x1D169},
-        {0x1D173, 0x1D182}, {0x1D185, 0x1D18B}, {0x1D1AA, 0x1D1AD},
-        {0x1D242, 0x1D244}, {0xE0001, 0xE0001}, {0xE0020, 0xE007F},
-        {0xE0100, 0xE01EF}};
-
-    /* test for 8-bit control characters */
-    if (ucs == 0) {
-        return 0;
+    if (g_term.headless) {
+        return g_term.size;
     }
-    if (ucs < 32 || (ucs >= 0x7f && ucs < 0xa0)) {
-        return -1;
-    }
-
-    /* binary search in table of non-spacing characters */
-    if (_term_bisearch(
-            ucs, combining, sizeof(combining) / sizeof(TermInterval) - 1)) {
-        return 0;
-    }
-
-    /* if we arrive here, ucs is not a combining or C0/C1 control character */
-
-    return 1 +
-           (ucs >= 0x1100 &&
-            (ucs <= 0x115f || /* Hangul Jamo init. consonants */
-             ucs == 0x2329 || ucs == 0x232a ||
-             (ucs >= 0x2e80 && ucs <= 0xa4cf &&
-              ucs != 0x303f) ||                  /* CJK ... Yi */
-             (ucs >= 0xac00 && ucs <= 0xd7a3) || /* Hangul Syllables */
-             (ucs >= 0xf900 &&
-              ucs <= 0xfaff) || /* CJK Compatibility Ideographs */
-             (ucs >= 0xfe10 && ucs <= 0xfe19) || /* Vertical forms */
-             (ucs >= 0xfe30 && ucs <= 0xfe6f) || /* CJK Compatibility Forms */
-             (ucs >= 0xff00 && ucs <= 0xff60) || /* Fullwidth Forms */
-             (ucs >= 0xffe0 && ucs <= 0xffe6) ||
-             (ucs >= 0x20000 && ucs <= 0x2fffd) ||
-             (ucs >= 0x30000 && ucs <= 0x3fffd)));
-}
-//------------------------------------------------------------------------------
 
-TermSize term_size_get(void)
-{
     TermSize term_size = {0};
 
 #        if KORE_OS_WINDOWS
@@ -332,45 +813,136 @@ internal void _term_platform_init()
 
 //------------------------------------------------------------------------------
 
-bool term_loop()
+// Queues a key event for a console key press.
+internal void _term_windows_key(const KEY_EVENT_RECORD* record)
 {
-    if (g_term.running) {
+    DWORD state     = record->dwControlKeyState;
+    u8    modifiers = ((state & SHIFT_PRESSED) ? TERM_MOD_SHIFT : 0) |
+                   ((state & (LEFT_ALT_PRESSED | RIGHT_ALT_PRESSED))
+                        ? TERM_MOD_ALT
+                        : 0);
+    u32 code = 0;
+
+    switch (record->wVirtualKeyCode) {
+    case VK_UP:
+        code = TERM_KEY_UP;
+        break;
+    case VK_DOWN:
+        code = TERM_KEY_DOWN;
+        break;
+    case VK_RIGHT:
+        code = TERM_KEY_RIGHT;
+        break;
+    case VK_LEFT:
+        code = TERM_KEY_LEFT;
+        break;
+    case VK_HOME:
+        code = TERM_KEY_HOME;
+        break;
+    case VK_END:
+        code = TERM_KEY_END;
+        break;
+    case VK_INSERT:
+        code = TERM_KEY_INSERT;
+        break;
+    case VK_DELETE:
+        code = TERM_KEY_DELETE;
+        break;
+    case VK_PRIOR:
+        code = TERM_KEY_PAGE_UP;
+        break;
+    case VK_NEXT:
+        code = TERM_KEY_PAGE_DOWN;
+        break;
+    default:
+        if (record->wVirtualKeyCode >= VK_F1 &&
+            record->wVirtualKeyCode <= VK_F12) {
+            code = TERM_KEY_F1 + (record->wVirtualKeyCode - VK_F1);
+        }
+        break;
+    }
 
-        // Windows-specific event polling can be added here
-        // We need to check any console events and handle them
-        HANDLE console = GetStdHandle(STD_INPUT_HANDLE);
-        if (console != INVALID_HANDLE_VALUE) {
-            DWORD events;
-            GetNumberOfConsoleInputEvents(console, &events);
-            while (events > 0) {
-                INPUT_RECORD record;
-                DWORD        read;
-                ReadConsoleInputA(console, &record, 1, &read);
-
-                switch (record.EventType) {
-                case WINDOW_BUFFER_SIZE_EVENT:
-                    {
-                        g_term.size = term_size_get();
-                        TermEvent event;
-                        event.kind = TERM_EVENT_RESIZE;
-                        event.size = g_term.size;
-                        _term_queue_event(event);
-                        _term_fb_resize(g_term.size.width, g_term.size.height);
-                    }
-                    break;
+    if (code != 0) {
+        if (state & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)) {
+            modifiers |= TERM_MOD_CTRL;
+        }
+        TermEvent event = {.kind = TERM_EVENT_KEY};
+        event.code      = code;
+        event.modifiers = modifiers;
+        _term_queue_event(event);
+    } else if (record->uChar.AsciiChar != 0) {
+        // Control characters imply Ctrl themselves.
+        _term_input_ascii((u8)record->uChar.AsciiChar, modifiers);
+    }
+}
 
-                case KEY_EVENT:
-                    if (record.Event.KeyEvent.bKeyDown) {
-                        TermEvent event;
-                        event.kind = TERM_EVENT_KEY;
-                        event.key  = record.Event.KeyEvent.uChar.AsciiChar;
-                        _term_queue_event(event);
-                    }
-                    break;
+// Reads all the pending console events, a batch of records at a time.
+internal void _term_read_input(void)
+{
+    HANDLE console = GetStdHandle(STD_INPUT_HANDLE);
+    if (g_term.headless || console == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    DWORD events = 0;
+    GetNumberOfConsoleInputEvents(console, &events);
+    while (events > 0) {
+        INPUT_RECORD records[TERM_INPUT_BUFFER_SIZE / sizeof(INPUT_RECORD)];
+        DWORD        read  = 0;
+        DWORD        count =
+            KORE_MIN(events, (DWORD)(sizeof(records) / sizeof(records[0])));
+        if (!ReadConsoleInputA(console, records, count, &read) || read == 0) {
+            break;
+        }
+
+        for (DWORD i = 0; i < read; ++i) {
+            INPUT_RECORD* record = &records[i];
+            switch (record->EventType) {
+            case WINDOW_BUFFER_SIZE_EVENT:
+                {
+                    g_term.size = term_size_get();
+                    TermEvent event;
+                    event.kind = TERM_EVENT_RESIZE;
+                    event.size = g_term.size;
+                    _term_queue_event(event);
+                    _term_fb_resize(g_term.size.width, g_term.size.height);
+                }
+                break;
+
+            case KEY_EVENT:
+                if (record->Event.KeyEvent.bKeyDown) {
+                    _term_windows_key(&record->Event.KeyEvent);
                 }
-                events--;
+                break;
             }
         }
+        events -= read;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool term_wait(TimeDuration timeout)
+{
+    if (g_term.headless) {
+        return _term_headless_wait(timeout);
+    }
+
+    if (g_term.event_queue.count == 0) {
+        HANDLE console = GetStdHandle(STD_INPUT_HANDLE);
+        int    ms      = _term_timeout_ms(timeout);
+        WaitForSingleObject(console, ms < 0 ? INFINITE : (DWORD)ms);
+        _term_read_input();
+    }
+    return g_term.event_queue.count > 0;
+}
+
+//------------------------------------------------------------------------------
+
+bool term_loop()
+{
+    if (g_term.running) {
+        _term_read_input();
         return true;
     } else {
         _term_stop();
@@ -429,6 +1001,42 @@ internal void _term_raw_leave(void)
 
 //------------------------------------------------------------------------------
 
+// Writes the bytes directly to the console, bypassing the pr() formatting.
+internal void _term_output(const u8* data, usize size)
+{
+    if (g_term.headless) {
+        _term_headless_capture(data, size);
+        return;
+    }
+
+    HANDLE handle = GetStdHandle(STD_OUTPUT_HANDLE);
+
+    mutex_lock(&g_kore_output_mutex);
+    while (size > 0) {
+        DWORD chunk   = (DWORD)KORE_MIN(size, (usize)0x40000000);
+        DWORD written = 0;
+        if (!WriteFile(handle, data, chunk, &written, NULL) || written == 0) {
+            break;
+        }
+        data += written;
+        size -= written;
+    }
+    mutex_unlock(&g_kore_output_mutex);
+}
+
+internal void _term_output_parts(const string* parts, usize count)
+{
+    for (usize i = 0; i < count; ++i) {
+        _term_output(parts[i].data, parts[i].count);
+    }
+}
+
+// Bytes written that the terminal has not read yet.  Console writes complete
+// synchronously, so there are none.
+internal usize _term_output_backlog(void) { return 0; }
+
+//------------------------------------------------------------------------------
+
 #    endif // KORE_OS_WINDOWS
 
 //------------------------------------------------------------------------------
@@ -439,19 +1047,30 @@ internal void _term_raw_leave(void)
 
 #    if KORE_OS_POSIX
 
+#        include <errno.h>
+#        include <fcntl.h>
+#        include <poll.h>
 #        include <signal.h>
 #        include <string.h>
 #        include <sys/ioctl.h>
+#        include <sys/uio.h>
 #        include <termios.h>
 
-// Signals when the terminal resizes
+// Signals when the terminal resizes.  The handler also writes a byte to the
+// wake pipe so that a term_wait() sleeping in poll() wakes up.
 global_variable volatile sig_atomic_t g_term_resize_signal = 0;
+global_variable int                   g_term_wake_pipe[2]  = {-1, -1};
 global_variable struct termios        g_term_original_tios;
+global_variable int                   g_term_original_stdout_flags = -1;
 
 //------------------------------------------------------------------------------
 
 TermSize term_size_get(void)
 {
+    if (g_term.headless) {
+        return g_term.size;
+    }
+
     TermSize term_size = {0};
 
     struct winsize w;
@@ -483,22 +1102,158 @@ internal void _term_raw_enter(void)
     raw_tios.c_cc[VTIME] = 0;
 
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw_tios);
+
+    if (g_term.nonblocking_output) {
+        g_term_original_stdout_flags = fcntl(STDOUT_FILENO, F_GETFL);
+        if (g_term_original_stdout_flags != -1) {
+            fcntl(STDOUT_FILENO,
+                  F_SETFL,
+                  g_term_original_stdout_flags | O_NONBLOCK);
+        }
+    }
 }
 
 internal void _term_raw_leave(void)
 {
+    if (g_term_original_stdout_flags != -1) {
+        fcntl(STDOUT_FILENO, F_SETFL, g_term_original_stdout_flags);
+        g_term_original_stdout_flags = -1;
+    }
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &g_term_original_tios);
 }
 
-internal void _term_raw_key(void)
+//------------------------------------------------------------------------------
+
+// Writes all the bytes directly to stdout, bypassing the pr() formatting.
+// Short writes are continued and, if stdout is non-blocking, we wait with
+// poll() until the terminal can take more.
+internal void _term_output(const u8* data, usize size)
 {
-    char c;
-    int  nread = read(STDIN_FILENO, &c, 1);
-    if (nread == 1) {
-        TermEvent event;
-        event.kind = TERM_EVENT_KEY;
-        event.key  = c;
-        _term_queue_event(event);
+    if (g_term.headless) {
+        _term_headless_capture(data, size);
+        return;
+    }
+
+    mutex_lock(&g_kore_output_mutex);
+    while (size > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, size);
+        if (written > 0) {
+            data += written;
+            size -= (usize)written;
+        } else if (written < 0 && errno == EINTR) {
+            continue;
+        } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = {.fd = STDOUT_FILENO, .events = POLLOUT};
+            poll(&pfd, 1, -1);
+        } else {
+            break;
+        }
+    }
+    mutex_unlock(&g_kore_output_mutex);
+}
+
+// The most buffers _term_output_parts writes in one go.
+#        define TERM_OUTPUT_MAX_PARTS 16
+
+// Writes several buffers one after another with a single writev(), so the
+// parts do not have to be copied together first.
+internal void _term_output_parts(const string* parts, usize count)
+{
+    KORE_ASSERT(count <= TERM_OUTPUT_MAX_PARTS, "Too many output parts");
+
+    if (g_term.headless) {
+        for (usize i = 0; i < count; ++i) {
+            _term_headless_capture(parts[i].data, parts[i].count);
+        }
+        return;
+    }
+
+    struct iovec vectors[TERM_OUTPUT_MAX_PARTS];
+    int          vector_count = 0;
+    for (usize i = 0; i < count; ++i) {
+        if (parts[i].count > 0) {
+            vectors[vector_count++] =
+                (struct iovec){.iov_base = parts[i].data,
+                               .iov_len  = parts[i].count};
+        }
+    }
+
+    struct iovec* next = vectors;
+    mutex_lock(&g_kore_output_mutex);
+    while (vector_count > 0) {
+        ssize_t written = writev(STDOUT_FILENO, next, vector_count);
+        if (written > 0) {
+            // Step over what was written, which may end part way through a
+            // buffer.
+            usize left = (usize)written;
+            while (vector_count > 0 && left >= next->iov_len) {
+                left -= next->iov_len;
+                next++;
+                vector_count--;
+            }
+            if (vector_count > 0) {
+                next->iov_base = (u8*)next->iov_base + left;
+                next->iov_len -= left;
+            }
+        } else if (written < 0 && errno == EINTR) {
+            continue;
+        } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = {.fd = STDOUT_FILENO, .events = POLLOUT};
+            poll(&pfd, 1, -1);
+        } else {
+            break;
+        }
+    }
+    mutex_unlock(&g_kore_output_mutex);
+}
+
+// Bytes written that the terminal has not read yet.  These build up in the
+// tty's output queue when the terminal cannot keep up.
+internal usize _term_output_backlog(void)
+{
+#        ifdef TIOCOUTQ
+    int bytes = 0;
+    if (!g_term.headless && ioctl(STDOUT_FILENO, TIOCOUTQ, &bytes) == 0 &&
+        bytes > 0) {
+        return (usize)bytes;
+    }
+#        endif
+    return 0;
+}
+
+// Called when no more input is immediately available.  A lone ESC is flushed
+// once nothing has followed it for TERM_INPUT_ESCAPE_TIMEOUT_MS.  Returns the
+// milliseconds left until then, or -1 if no ESC is waiting.
+internal int _term_input_expire(void)
+{
+    if (g_term_input.state != TERM_INPUT_ESCAPE) {
+        return -1;
+    }
+    u64 waited_ms =
+        time_duration_to_ms(time_elapsed(g_term_input.read_time, time_now()));
+    if (waited_ms >= TERM_INPUT_ESCAPE_TIMEOUT_MS) {
+        _term_input_flush();
+        return -1;
+    }
+    return (int)(TERM_INPUT_ESCAPE_TIMEOUT_MS - waited_ms);
+}
+
+// Reads all the input that is available (up to a buffer's worth) in one go.
+// Stdin is in raw mode with VMIN=0 and VTIME=0, so this never blocks.
+internal void _term_read_input(void)
+{
+    if (g_term.headless) {
+        return;
+    }
+
+    u8      buffer[TERM_INPUT_BUFFER_SIZE];
+    ssize_t nread = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (nread > 0) {
+        g_term_input.read_time = time_now();
+        _term_input_decode(buffer, (usize)nread);
+    }
+    if (nread < (ssize_t)sizeof(buffer)) {
+        _term_input_expire();
     }
 }
 
@@ -508,10 +1263,30 @@ internal void _term_on_winch(int sig)
 {
     KORE_UNUSED(sig);
     g_term_resize_signal = 1;
+
+    // If the pipe is full, a wake up is already pending.
+    int saved_errno = errno;
+    if (g_term_wake_pipe[1] != -1) {
+        u8      byte    = 0;
+        ssize_t written = write(g_term_wake_pipe[1], &byte, 1);
+        KORE_UNUSED(written);
+    }
+    errno = saved_errno;
 }
 
 internal void _term_install_resize_handler(void)
 {
+    if (pipe(g_term_wake_pipe) == 0) {
+        for (int i = 0; i < 2; ++i) {
+            int fd = g_term_wake_pipe[i];
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+    } else {
+        g_term_wake_pipe[0] = -1;
+        g_term_wake_pipe[1] = -1;
+    }
+
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = _term_on_winch;
@@ -526,6 +1301,13 @@ internal void _term_remove_resize_handler(void)
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = SIG_DFL;
     sigaction(SIGWINCH, &sa, NULL);
+
+    for (int i = 0; i < 2; ++i) {
+        if (g_term_wake_pipe[i] != -1) {
+            close(g_term_wake_pipe[i]);
+            g_term_wake_pipe[i] = -1;
+        }
+    }
 }
 
 //------------------------------------------------------------------------------
@@ -542,37 +1324,81 @@ internal void _term_platform_init(void)
 
 //------------------------------------------------------------------------------
 
-bool term_loop(void)
+// Queues a resize event if the terminal has signalled a change in size.
+internal void _term_check_resize(void)
 {
-    if (g_term.running) {
-
-        // Check for terminal resize signal
-        if (g_term_resize_signal) {
-            g_term_resize_signal = 0;
-            TermSize new_size    = term_size_get();
-            if (new_size.width != g_term.size.width ||
-                new_size.height != g_term.size.height) {
-                g_term.size = new_size;
-                TermEvent event;
-                event.kind = TERM_EVENT_RESIZE;
-                event.size = g_term.size;
-                _term_queue_event(event);
-                _term_fb_resize(new_size.width, new_size.height);
-            }
+    if (g_term_resize_signal) {
+        g_term_resize_signal = 0;
+        TermSize new_size    = term_size_get();
+        if (new_size.width != g_term.size.width ||
+            new_size.height != g_term.size.height) {
+            g_term.size = new_size;
+            TermEvent event;
+            event.kind = TERM_EVENT_RESIZE;
+            event.size = g_term.size;
+            _term_queue_event(event);
+            _term_fb_resize(new_size.width, new_size.height);
         }
-        _term_raw_key();
-        return true;
-    } else {
-        // Unregister the signal handler
-        _term_remove_resize_handler();
-        _term_stop();
-        return false;
     }
 }
 
 //------------------------------------------------------------------------------
 
-#    endif // KORE_OS_POSIX
+bool term_wait(TimeDuration timeout)
+{
+    if (g_term.headless) {
+        return _term_headless_wait(timeout);
+    }
+
+    // A lone ESC becomes the Escape key if the rest of a sequence does not
+    // follow in time, so the wait is cut short to check for that.
+    int escape_ms = _term_input_expire();
+    if (g_term.event_queue.count == 0 && !g_term_resize_signal) {
+        struct pollfd fds[2] = {
+            {.fd = STDIN_FILENO, .events = POLLIN},
+            {.fd = g_term_wake_pipe[0], .events = POLLIN},
+        };
+
+        int ms = _term_timeout_ms(timeout);
+        if (escape_ms >= 0 && (ms < 0 || escape_ms < ms)) {
+            ms = escape_ms;
+        }
+        if (poll(fds, 2, ms) > 0) {
+            if (fds[1].revents & POLLIN) {
+                u8 drain[64];
+                while (read(g_term_wake_pipe[0], drain, sizeof(drain)) > 0) {
+                }
+            }
+            if (fds[0].revents & (POLLIN | POLLHUP)) {
+                _term_read_input();
+            }
+        }
+        _term_input_expire();
+    }
+
+    _term_check_resize();
+    return g_term.event_queue.count > 0;
+}
+
+//------------------------------------------------------------------------------
+
+bool term_loop(void)
+{
+    if (g_term.running) {
+        _term_check_resize();
+        _term_read_input();
+        return true;
+    } else {
+        // Unregister the signal handler
+        _term_remove_resize_handler();
+        _term_stop();
+        return false;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+#    endif // KORE_OS_POSIX
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
@@ -594,54 +1420,505 @@ void dump_term_size(void)
 
 //------------------------------------------------------------------------------
 
+#    define TERM_EVENT_QUEUE_INITIAL_CAPACITY 64
+
 internal void _term_queue_event(TermEvent event)
 {
-    array_push(g_term.event_queue, event);
+    TermEventQueue* queue = &g_term.event_queue;
+
+    if (queue->count == queue->capacity) {
+        u32 old_capacity = queue->capacity;
+        u32 new_capacity = old_capacity ? old_capacity * 2
+                                        : TERM_EVENT_QUEUE_INITIAL_CAPACITY;
+        queue->events =
+            KORE_ARRAY_REALLOC(queue->events, TermEvent, new_capacity);
+        queue->capacity = new_capacity;
+
+        // Move the events that had wrapped around to follow on from the end.
+        memcpy(queue->events + old_capacity,
+               queue->events,
+               queue->head * sizeof(TermEvent));
+    }
+
+    queue->events[(queue->head + queue->count) & (queue->capacity - 1)] =
+        event;
+    queue->count++;
+}
+
+// Returns the most recently queued event, or NULL if the queue is empty.
+internal TermEvent* _term_queue_last(void)
+{
+    TermEventQueue* queue = &g_term.event_queue;
+    if (queue->count == 0) {
+        return NULL;
+    }
+    return &queue->events[(queue->head + queue->count - 1) &
+                          (queue->capacity - 1)];
+}
+
+internal void _term_queue_done(void)
+{
+    KORE_ARRAY_FREE(g_term.event_queue.events);
+    g_term.event_queue = (TermEventQueue){0};
+}
+
+//------------------------------------------------------------------------------
+// Input decoding
+//
+// Input is decoded a byte at a time by a small state machine that never
+// allocates (pasted text aside), so it can be fed straight from the bulk read
+// buffer.  Sequences split across reads are continued by the next read.
+
+// Keys for the final byte of CSI and SS3 sequences, e.g. ESC [ A or ESC O P.
+global_variable const u32 g_term_final_keys[26] = {
+    ['A' - 'A'] = TERM_KEY_UP,
+    ['B' - 'A'] = TERM_KEY_DOWN,
+    ['C' - 'A'] = TERM_KEY_RIGHT,
+    ['D' - 'A'] = TERM_KEY_LEFT,
+    ['F' - 'A'] = TERM_KEY_END,
+    ['H' - 'A'] = TERM_KEY_HOME,
+    ['M' - 'A'] = TERM_KEY_ENTER,
+    ['P' - 'A'] = TERM_KEY_F1,
+    ['Q' - 'A'] = TERM_KEY_F2,
+    ['R' - 'A'] = TERM_KEY_F3,
+    ['S' - 'A'] = TERM_KEY_F4,
+    ['Z' - 'A'] = TERM_KEY_TAB, // Shift+Tab
+};
+
+// Keys for the first parameter of CSI ~ sequences, e.g. ESC [ 3 ~.
+global_variable const u32 g_term_tilde_keys[25] = {
+    [1]  = TERM_KEY_HOME,
+    [2]  = TERM_KEY_INSERT,
+    [3]  = TERM_KEY_DELETE,
+    [4]  = TERM_KEY_END,
+    [5]  = TERM_KEY_PAGE_UP,
+    [6]  = TERM_KEY_PAGE_DOWN,
+    [7]  = TERM_KEY_HOME,
+    [8]  = TERM_KEY_END,
+    [11] = TERM_KEY_F1,
+    [12] = TERM_KEY_F2,
+    [13] = TERM_KEY_F3,
+    [14] = TERM_KEY_F4,
+    [15] = TERM_KEY_F5,
+    [17] = TERM_KEY_F6,
+    [18] = TERM_KEY_F7,
+    [19] = TERM_KEY_F8,
+    [20] = TERM_KEY_F9,
+    [21] = TERM_KEY_F10,
+    [23] = TERM_KEY_F11,
+    [24] = TERM_KEY_F12,
+};
+
+// Sent by the terminal at the end of a bracketed paste.
+global_variable const u8 g_term_paste_end[] = "\x1b[201~";
+
+internal void _term_input_key(u32 code, u8 modifiers)
+{
+    TermEvent event = {.kind = TERM_EVENT_KEY};
+    event.key       = code < 0x80 ? (char)code : 0;
+    event.code      = code;
+    event.modifiers = modifiers;
+    _term_queue_event(event);
+}
+
+// Decodes a single byte key.  Control characters become Ctrl with the
+// matching character, but `key` keeps the byte that was received.
+internal void _term_input_ascii(u8 byte, u8 modifiers)
+{
+    u32 code = byte;
+    switch (byte) {
+    case 0x08:
+    case 0x7F:
+        code = TERM_KEY_BACKSPACE;
+        break;
+
+    case TERM_KEY_TAB:
+    case TERM_KEY_ENTER:
+    case TERM_KEY_ESCAPE:
+        break;
+
+    default:
+        if (byte < 0x20) {
+            code = byte == 0 ? ' ' : (u32)(byte + (byte <= 0x1A ? 0x60 : 0x40));
+            modifiers |= TERM_MOD_CTRL;
+        }
+        break;
+    }
+
+    TermEvent event = {.kind = TERM_EVENT_KEY};
+    event.key       = (char)byte;
+    event.code      = code;
+    event.modifiers = modifiers;
+    _term_queue_event(event);
+}
+
+// Decodes an SGR (1006) mouse report: ESC [ < b ; x ; y M (or m on release).
+internal void _term_input_mouse(TermInputDecoder* decoder, u8 final)
+{
+    if (decoder->param_count < 3) {
+        return;
+    }
+
+    u32       b     = decoder->params[0];
+    TermEvent event = {.kind = TERM_EVENT_MOUSE};
+    event.mouse.x   = (u16)KORE_MAX(decoder->params[1], 1u) - 1;
+    event.mouse.y   = (u16)KORE_MAX(decoder->params[2], 1u) - 1;
+    event.mouse.modifiers =
+        ((b & 4) ? TERM_MOD_SHIFT : 0) | ((b & 8) ? TERM_MOD_ALT : 0) |
+        ((b & 16) ? TERM_MOD_CTRL : 0);
+
+    if (b & 64) {
+        event.mouse.button = (TermMouseButton)(TERM_MOUSE_WHEEL_UP + (b & 3));
+        event.mouse.action = TERM_MOUSE_WHEEL;
+    } else {
+        event.mouse.button = (TermMouseButton)(b & 3);
+        event.mouse.action = (b & 32)       ? TERM_MOUSE_MOVE
+                             : final == 'M' ? TERM_MOUSE_PRESS
+                                            : TERM_MOUSE_RELEASE;
+    }
+
+    // Motion reports arrive far faster than frames, so a move replaces the
+    // one before it if nothing else has happened in between.
+    TermEvent* last = _term_queue_last();
+    if (event.mouse.action == TERM_MOUSE_MOVE && last) {
+        if (last->kind == TERM_EVENT_MOUSE &&
+            last->mouse.action == TERM_MOUSE_MOVE &&
+            last->mouse.button == event.mouse.button &&
+            last->mouse.modifiers == event.mouse.modifiers) {
+            *last = event;
+            return;
+        }
+    }
+
+    _term_queue_event(event);
+}
+
+internal void _term_input_csi(TermInputDecoder* decoder, u8 final)
+{
+    u32 p0        = decoder->params[0];
+    u32 mod_param = decoder->param_count > 1 ? decoder->params[1] : 0;
+    u8  modifiers = decoder->modifiers;
+    if (mod_param > 1) {
+        modifiers |= (u8)((mod_param - 1) & 0x0F);
+    }
+
+    if (decoder->marker == '<') {
+        if (final == 'M' || final == 'm') {
+            _term_input_mouse(decoder, final);
+        }
+        return;
+    }
+    if (decoder->marker != 0) {
+        // Replies to queries we do not make.
+        return;
+    }
+
+    if (final == 'R' && g_term.rep_probe && decoder->param_count == 2 &&
+        p0 == 2) {
+        // The cursor position reply to the REP probe.  The cursor only
+        // reaches the third column if the terminal repeated the space.  The
+        // probe's row tells it apart from modified F3 keys, which are CSI 1;mR.
+        g_term.rep_probe = false;
+        g_term.rep       = decoder->params[1] == 3;
+        return;
+    }
+
+    if (final == '~') {
+        if (p0 == 200) {
+            decoder->state       = TERM_INPUT_PASTE;
+            decoder->paste_start = array_count(g_term_paste);
+            decoder->paste_match = 0;
+        } else if (p0 < sizeof(g_term_tilde_keys) /
+                             sizeof(g_term_tilde_keys[0]) &&
+                   g_term_tilde_keys[p0] != 0) {
+            _term_input_key(g_term_tilde_keys[p0], modifiers);
+        }
+    } else if (final >= 'A' && final <= 'Z' &&
+               g_term_final_keys[final - 'A'] != 0) {
+        if (final == 'Z') {
+            modifiers |= TERM_MOD_SHIFT;
+        }
+        _term_input_key(g_term_final_keys[final - 'A'], modifiers);
+    }
+}
+
+internal void _term_input_paste_bytes(const u8* data, usize size)
+{
+    usize at = array_count(g_term_paste);
+    array_reserve(g_term_paste, at + size);
+    memcpy(g_term_paste + at, data, size);
+}
+
+// Consumes bracketed paste text, returning how many bytes were used.  Text is
+// copied in runs up to the next ESC, which may start the terminator.
+internal usize _term_input_paste(TermInputDecoder* decoder,
+                                 const u8*         data,
+                                 usize             size)
+{
+    usize i = 0;
+    while (i < size && decoder->state == TERM_INPUT_PASTE) {
+        if (decoder->paste_match == 0) {
+            const u8* esc = memchr(data + i, 0x1B, size - i);
+            usize     run = esc ? (usize)(esc - (data + i)) : size - i;
+            _term_input_paste_bytes(data + i, run);
+            i += run;
+            if (i == size) {
+                break;
+            }
+        }
+
+        u8 byte = data[i++];
+        if (byte == g_term_paste_end[decoder->paste_match]) {
+            if (++decoder->paste_match == sizeof(g_term_paste_end) - 1) {
+                // The text is given as an offset into g_term_paste until the
+                // event is polled, as the buffer may move as it grows.
+                TermEvent event  = {.kind = TERM_EVENT_PASTE};
+                event.paste.text = (const u8*)(uintptr_t)decoder->paste_start;
+                event.paste.length =
+                    array_count(g_term_paste) - decoder->paste_start;
+                _term_queue_event(event);
+                decoder->state = TERM_INPUT_GROUND;
+            }
+        } else {
+            // Not the terminator after all, so keep what was matched.
+            _term_input_paste_bytes(g_term_paste_end, decoder->paste_match);
+            decoder->paste_match = 0;
+            i--;
+        }
+    }
+    return i;
+}
+
+internal void _term_input_decode(const u8* data, usize size)
+{
+    TermInputDecoder* decoder = &g_term_input;
+
+    // Pasted text only has to live until its event has been polled.
+    if (g_term.event_queue.count == 0 &&
+        decoder->state != TERM_INPUT_PASTE) {
+        array_clear(g_term_paste);
+    }
+
+    usize i = 0;
+    while (i < size) {
+        if (decoder->state == TERM_INPUT_PASTE) {
+            i += _term_input_paste(decoder, data + i, size - i);
+            continue;
+        }
+
+        u8 byte = data[i++];
+        switch (decoder->state) {
+        case TERM_INPUT_GROUND:
+            if (byte == 0x1B) {
+                decoder->state = TERM_INPUT_ESCAPE;
+            } else if (byte < 0x80) {
+                _term_input_ascii(byte, decoder->modifiers);
+                decoder->modifiers = 0;
+            } else if (byte >= 0xC0 && byte < 0xF8) {
+                decoder->utf8_remaining = byte >= 0xF0   ? 3
+                                          : byte >= 0xE0 ? 2
+                                                         : 1;
+                decoder->code  = byte & (0x3F >> decoder->utf8_remaining);
+                decoder->state = TERM_INPUT_UTF8;
+            } else {
+                _term_input_key(0xFFFD, decoder->modifiers);
+                decoder->modifiers = 0;
+            }
+            break;
+
+        case TERM_INPUT_UTF8:
+            if ((byte & 0xC0) == 0x80) {
+                decoder->code = (decoder->code << 6) | (byte & 0x3F);
+                if (--decoder->utf8_remaining == 0) {
+                    _term_input_key(decoder->code, decoder->modifiers);
+                    decoder->modifiers = 0;
+                    decoder->state     = TERM_INPUT_GROUND;
+                }
+            } else {
+                // Truncated character; decode this byte afresh.
+                _term_input_key(0xFFFD, decoder->modifiers);
+                decoder->modifiers = 0;
+                decoder->state     = TERM_INPUT_GROUND;
+                i--;
+            }
+            break;
+
+        case TERM_INPUT_ESCAPE:
+            if (byte == '[' || byte == 'O') {
+                decoder->state = byte == '[' ? TERM_INPUT_CSI : TERM_INPUT_SS3;
+                decoder->params[0]   = 0;
+                decoder->param_count = 1;
+                decoder->marker      = 0;
+            } else if (byte == 0x1B) {
+                _term_input_key(TERM_KEY_ESCAPE, 0);
+            } else {
+                // ESC before a key means Alt was held.
+                decoder->modifiers = TERM_MOD_ALT;
+                decoder->state     = TERM_INPUT_GROUND;
+                i--;
+            }
+            break;
+
+        case TERM_INPUT_CSI:
+            if (byte >= '0' && byte <= '9') {
+                u32* param = &decoder->params[decoder->param_count - 1];
+                *param     = KORE_MIN(*param * 10 + (byte - '0'), 0xFFFFu);
+            } else if (byte == ';' || byte == ':') {
+                if (decoder->param_count < TERM_INPUT_MAX_PARAMS) {
+                    decoder->params[decoder->param_count++] = 0;
+                }
+            } else if (byte >= 0x3C && byte <= 0x3F) {
+                decoder->marker = byte;
+            } else if (byte >= 0x40 && byte <= 0x7E) {
+                decoder->state = TERM_INPUT_GROUND;
+                _term_input_csi(decoder, byte);
+                decoder->modifiers = 0;
+            } else if (byte < 0x20 || byte > 0x7E) {
+                // Malformed sequence.
+                decoder->state     = TERM_INPUT_GROUND;
+                decoder->modifiers = 0;
+            }
+            break;
+
+        case TERM_INPUT_SS3:
+            decoder->state = TERM_INPUT_GROUND;
+            if (byte >= 'A' && byte <= 'Z' &&
+                g_term_final_keys[byte - 'A'] != 0) {
+                _term_input_key(g_term_final_keys[byte - 'A'],
+                                decoder->modifiers);
+            }
+            decoder->modifiers = 0;
+            break;
+
+        case TERM_INPUT_PASTE:
+            break;
+        }
+    }
+}
+
+// Takes a lone ESC at the end of the input as the Escape key rather than the
+// start of a sequence.
+internal void _term_input_flush(void)
+{
+    if (g_term_input.state == TERM_INPUT_ESCAPE) {
+        g_term_input.state = TERM_INPUT_GROUND;
+        _term_input_key(TERM_KEY_ESCAPE, 0);
+    }
 }
 
 //------------------------------------------------------------------------------
 
-internal void _term_alt_enter(void) { pr("\x1b[?1049h"); }
+#    define _term_output_literal(str)                                         \
+        _term_output((const u8*)(str), sizeof(str) - 1)
+
+internal void _term_alt_enter(void) { _term_output_literal("\x1b[?1049h"); }
 
-internal void _term_alt_leave(void) { pr("\x1b[?1049l"); }
+internal void _term_alt_leave(void) { _term_output_literal("\x1b[?1049l"); }
 
 //------------------------------------------------------------------------------
 
 internal void _term_start(void)
 {
-    _term_platform_init();
-    _term_alt_enter();
-    _term_raw_enter();
+    // Before the alternate screen, so any errors can be seen.
+    _term_broadcast_start();
+    _term_record_start();
+
+    if (g_term.headless) {
+        _term_headless_start();
+    } else {
+        _term_platform_init();
+        _term_alt_enter();
+        _term_raw_enter();
+    }
+
+    // Pasted text is reported as a single event rather than as keys.
+    _term_output_literal("\x1b[?2004h");
+    if (g_term.mouse) {
+        // Button and drag reports, in the SGR format.
+        _term_output_literal("\x1b[?1002h\x1b[?1006h");
+    }
+
+    // Probe for REP (repeat the last character) by printing a space on the
+    // second row, repeating it and asking where the cursor ended up.  The
+    // reply arrives with the input, and until it does, or if it never does,
+    // runs are sent in full.  The screen is repainted by the first present
+    // anyway.  The headless screen understands REP, so it is not probed.
+    // Broadcast clients might not, so then it is never used.  Windows input
+    // is read as console records rather than decoded, so the reply would
+    // never be seen.
+    bool broadcast   = g_term.broadcast_path != NULL;
+    g_term.rep       = g_term.headless && !broadcast;
+    g_term.rep_probe = KORE_OS_POSIX && !g_term.headless && !broadcast;
+    if (g_term.rep_probe) {
+        _term_output_literal("\x1b[2H \x1b[b\x1b[6n");
+    }
+
+    if (g_term.threaded_output) {
+        _term_writer_start();
+    }
 }
 
 internal void _term_stop(void)
 {
-    array_free(g_term.event_queue);
+    // Let the last frame reach the terminal before restoring it.
+    _term_writer_stop();
+    _term_broadcast_stop();
+    _term_record_stop();
+
+    if (g_term.mouse) {
+        _term_output_literal("\x1b[?1006l\x1b[?1002l");
+    }
+    _term_output_literal("\x1b[?2004l");
+
+    _term_queue_done();
+    array_free(g_term_paste);
+    g_term_input = (TermInputDecoder){0};
     _term_fb_done();
     if (!g_cursor_visible) {
         term_cursor_show();
     }
-    _term_alt_leave();
-    _term_raw_leave();
+    if (g_term.headless) {
+        _term_headless_done();
+    } else {
+        _term_alt_leave();
+        _term_raw_leave();
+    }
+    arena_done(&g_term_screen_arena);
     arena_done(&g_term_arena);
+    g_term.initialised = false;
 }
 
 //------------------------------------------------------------------------------
 
-void term_init(void)
+void _term_init(TermInitParams params)
 {
     if (g_term.initialised) {
         return;
     }
 
-    setlocale(LC_CTYPE, "");
-
     // Initialise the terminal, ready for a loop
     g_term.size        = (TermSize){0};
-    g_term.running     = true;
-    g_term.initialised = true;
+    g_term.colour_mode        = params.colour_mode;
+    g_term.nonblocking_output = params.nonblocking_output;
+    g_term.mouse              = params.mouse;
+    g_term.present_threads    = params.present_threads;
+    g_term.threaded_output    = params.threaded_output;
+    g_term.broadcast_path     = params.broadcast_path;
+    g_term.record_path        = params.record_path;
+    g_term.record_keyframe_ms = params.record_keyframe_ms;
+    g_term.frame_rate         = params.frame_rate;
+    g_term.headless           = params.headless_size.width > 0 &&
+                      params.headless_size.height > 0;
+    g_term.running            = true;
+    g_term.initialised        = true;
+    if (g_term.headless) {
+        g_term.size = params.headless_size;
+    }
 
     arena_init(&g_term_arena, .reserved_size = KORE_MB(128), .grow_rate = 1);
+    arena_init(
+        &g_term_screen_arena, .reserved_size = KORE_MB(128), .grow_rate = 1);
+    _term_frame_reset();
 
     _term_start();
 }
@@ -659,26 +1936,49 @@ void term_cls(void) { pr("\x1b[2J\x1b[3J\x1b[H"); }
 TermEvent term_poll_event(void)
 {
     TermEvent event;
-    if (array_count(g_term.event_queue) > 0) {
-        event = g_term.event_queue[0];
-        array_delete(g_term.event_queue, 0);
-    } else {
+    if (term_poll_events(&event, 1) == 0) {
         event.kind = TERM_EVENT_NONE;
     }
     return event;
 }
 
+usize term_poll_events(TermEvent* out, usize max)
+{
+    TermEventQueue* queue = &g_term.event_queue;
+    usize           count = KORE_MIN(max, (usize)queue->count);
+    if (count == 0) {
+        return 0;
+    }
+
+    // The events are copied in at most two runs, either side of the wrap.
+    usize first = KORE_MIN(count, (usize)(queue->capacity - queue->head));
+    memcpy(out, queue->events + queue->head, first * sizeof(TermEvent));
+    memcpy(out + first, queue->events, (count - first) * sizeof(TermEvent));
+
+    queue->head   = (u32)((queue->head + count) & (queue->capacity - 1));
+    queue->count -= (u32)count;
+
+    for (usize i = 0; i < count; ++i) {
+        if (out[i].kind == TERM_EVENT_PASTE) {
+            out[i].paste.text = g_term_paste + (uintptr_t)out[i].paste.text;
+        }
+    }
+    return count;
+}
+
 //------------------------------------------------------------------------------
 
 void term_cursor_show(void)
 {
-    pr("\x1b[?25h");
+    _term_writer_wait();
+    _term_output_literal("\x1b[?25h");
     g_cursor_visible = true;
 }
 
 void term_cursor_hide(void)
 {
-    pr("\x1b[?25l");
+    _term_writer_wait();
+    _term_output_literal("\x1b[?25l");
     g_cursor_visible = false;
 }
 
@@ -755,55 +2055,203 @@ void term_cursor_left(int delta)
 
 //------------------------------------------------------------------------------
 
+// Marks `count` cells starting at (x, y) as dirty.  The span must lie within
+// the framebuffer, so that a bad one is caught here rather than when the
+// encoder reads past the row.
+internal void _term_fb_mark_dirty(u16 x, u16 y, u16 count)
+{
+    KORE_ASSERT((usize)x + count <= g_term_fb_size.width &&
+                    y < g_term_fb_size.height,
+                "Dirty span (%u, %u) + %u is off the framebuffer",
+                x,
+                y,
+                count);
+    if (count == 0) {
+        return;
+    }
+
+    u64*  row        = g_term_fb_dirty + (usize)y * g_term_fb_dirty_words;
+    usize first      = x;
+    usize last       = (usize)x + count - 1;
+    usize first_word = first >> 6;
+    usize last_word  = last >> 6;
+    u64   first_mask = ~0ull << (first & 63);
+    u64   last_mask  = ~0ull >> (63 - (last & 63));
+
+    if (first_word == last_word) {
+        row[first_word] |= first_mask & last_mask;
+    } else {
+        row[first_word] |= first_mask;
+        for (usize word = first_word + 1; word < last_word; ++word) {
+            row[word] = ~0ull;
+        }
+        row[last_word] |= last_mask;
+    }
+
+    if (x < g_term_fb_dirty_x0[y]) {
+        g_term_fb_dirty_x0[y] = x;
+    }
+    if (x + count > g_term_fb_dirty_x1[y]) {
+        g_term_fb_dirty_x1[y] = (u16)(x + count);
+    }
+    g_term_fb_dirty_rows[y >> 6] |= 1ull << (y & 63);
+}
+
+// Clears the dirty cells of a row, leaving its bit in g_term_fb_dirty_rows to
+// the caller.  Rows share words of that bitset, so this lets different rows
+// be cleared at the same time by different threads.
+internal void _term_fb_clear_dirty_cells(u16 y)
+{
+    u16 x0 = g_term_fb_dirty_x0[y];
+    u16 x1 = g_term_fb_dirty_x1[y];
+    if (x0 < x1) {
+        u64*  row        = g_term_fb_dirty + (usize)y * g_term_fb_dirty_words;
+        usize first_word = x0 >> 6;
+        usize last_word  = (usize)(x1 - 1) >> 6;
+        memset(row + first_word, 0, (last_word - first_word + 1) * sizeof(u64));
+    }
+    g_term_fb_dirty_x0[y] = UINT16_MAX;
+    g_term_fb_dirty_x1[y] = 0;
+}
+
+// Copies the dirty cells of one row to another.
+internal void _term_fb_copy_dirty_row(u16 dst_y, u16 src_y)
+{
+    usize words = g_term_fb_dirty_words;
+    memcpy(g_term_fb_dirty + (usize)dst_y * words,
+           g_term_fb_dirty + (usize)src_y * words,
+           words * sizeof(u64));
+    g_term_fb_dirty_x0[dst_y] = g_term_fb_dirty_x0[src_y];
+    g_term_fb_dirty_x1[dst_y] = g_term_fb_dirty_x1[src_y];
+
+    u64 bit                   = 1ull << (dst_y & 63);
+    if (g_term_fb_dirty_x0[src_y] < g_term_fb_dirty_x1[src_y]) {
+        g_term_fb_dirty_rows[dst_y >> 6] |= bit;
+    } else {
+        g_term_fb_dirty_rows[dst_y >> 6] &= ~bit;
+    }
+}
+
+// Points the planes at a block holding `capacity` cells in each.
+internal void _term_fb_set_planes(u8* block, usize capacity)
+{
+    g_term_fb_block    = block;
+    g_term_fb_capacity = capacity;
+
+#    if TERM_FB_INTERLEAVED
+    g_term_fb_cells       = (TermCell*)block;
+    g_term_fb_front_cells = g_term_fb_cells + capacity;
+#    else
+    g_term_fb_chars       = (u32*)block;
+    g_term_fb_ink         = g_term_fb_chars + capacity;
+    g_term_fb_paper       = g_term_fb_ink + capacity;
+    g_term_fb_front_chars = g_term_fb_paper + capacity;
+    g_term_fb_front_ink   = g_term_fb_front_chars + capacity;
+    g_term_fb_front_paper = g_term_fb_front_ink + capacity;
+#    endif
+}
+
+// Moves the first `rows` rows of a plane from one width to another.  When the
+// plane is resized in place, rows move towards the end as the width grows, so
+// they are moved last to first to avoid overwriting rows not yet moved.
+internal void _term_fb_move_rows(
+    u8* dst, const u8* src, u16 old_width, u16 new_width, u16 rows)
+{
+    usize row_bytes = KORE_MIN(old_width, new_width) * TERM_FB_CELL_SIZE;
+    usize src_pitch = old_width * TERM_FB_CELL_SIZE;
+    usize dst_pitch = new_width * TERM_FB_CELL_SIZE;
+
+    if (new_width > old_width) {
+        for (u16 y = rows; y-- > 0;) {
+            memmove(dst + y * dst_pitch, src + y * src_pitch, row_bytes);
+        }
+    } else {
+        for (u16 y = 0; y < rows; ++y) {
+            memmove(dst + y * dst_pitch, src + y * src_pitch, row_bytes);
+        }
+    }
+}
+
 internal void _term_fb_resize(u16 width, u16 height)
 {
-    TermSize size                 = g_term_fb_size;
-    usize    current_num_elements = size.width * size.height;
-    usize    num_elements         = width * height;
-
-    if (num_elements > current_num_elements) {
-        // Need to allocate more memory
-        array_reserve(g_term_fb_chars, num_elements);
-        array_reserve(g_term_fb_ink, num_elements);
-        array_reserve(g_term_fb_paper, num_elements);
-        array_reserve(g_term_fb_dirty, num_elements);
-    }
-
-    // If the width or height as reduced, we need to truncate by repositioning
-    // the rows in the array. If the have grown, we need to pad the rows out.
-    // Either way, we should reorganise the elements in the array so that the 2D
-    // rectangle is either grown or truncated.
-    for (u16 y = 0; y < height; y++) {
-        for (u16 x = 0; x < width; x++) {
-            usize new_index = y * width + x;
-            usize old_index = y * size.width + x;
-            if (x < size.width && y < size.height) {
-                // Copy existing data
-                g_term_fb_chars[new_index] = g_term_fb_chars[old_index];
-                g_term_fb_ink[new_index]   = g_term_fb_ink[old_index];
-                g_term_fb_paper[new_index] = g_term_fb_paper[old_index];
-                g_term_fb_dirty[new_index] = g_term_fb_dirty[old_index];
-            } else {
-                // New area, clear it
-                g_term_fb_chars[new_index] = ' ';
-                g_term_fb_ink[new_index]   = term_rgba(255, 255, 255, 255);
-                g_term_fb_paper[new_index] = term_rgba(0, 0, 0, 255);
-                g_term_fb_dirty[new_index] = 1;
-            }
+    TermSize size         = g_term_fb_size;
+    usize    num_elements = (usize)width * height;
+    u16      rows         = KORE_MIN(size.height, height);
+    u8*      old_block    = g_term_fb_block;
+    usize    old_capacity = g_term_fb_capacity;
+    u8*      new_block    = old_block;
+    usize    new_capacity = old_capacity;
+
+    if (num_elements > old_capacity) {
+        new_capacity = num_elements;
+        new_block    = (u8*)KORE_ALLOC(new_capacity * TERM_FB_CELL_SIZE *
+                                    TERM_FB_PLANES);
+    }
+
+    // Keep what we can of the back buffer.  The front buffer is about to be
+    // invalidated so its contents do not matter.
+    if (old_block) {
+        for (usize plane = 0; plane < TERM_FB_BACK_PLANES; ++plane) {
+            _term_fb_move_rows(
+                new_block + plane * new_capacity * TERM_FB_CELL_SIZE,
+                old_block + plane * old_capacity * TERM_FB_CELL_SIZE,
+                size.width,
+                width,
+                rows);
+        }
+        if (new_block != old_block) {
+            KORE_FREE(old_block);
         }
     }
+    _term_fb_set_planes(new_block, new_capacity);
 
-    // Update the size
     g_term_fb_size.width  = width;
     g_term_fb_size.height = height;
+
+    // Clear the new areas to the right of and below the old contents.
+    u32      ink   = term_rgba(255, 255, 255, 255);
+    u32      paper = term_rgba(0, 0, 0, 255);
+    TermRect right = {
+        size.width, 0, width > size.width ? width - size.width : 0, rows};
+    TermRect below = {0, rows, width, height - rows};
+    if (right.width > 0) {
+        _term_fb_fill_rect(right, TERM_FB_FILL_ALL, ' ', ink, paper);
+    }
+    _term_fb_fill_rect(below, TERM_FB_FILL_ALL, ' ', ink, paper);
+
+    // The terminal is free to reflow or clear its contents when it resizes, so
+    // we can no longer trust what we last sent.  Invalidate the front buffer
+    // and mark everything dirty so the next present repaints the screen.
+    _term_fb_invalidate_front();
+    array_clear(g_term_fb_scrolls);
+
+    g_term_fb_dirty_words = ((usize)width + 63) / 64;
+    array_reserve(g_term_fb_dirty, g_term_fb_dirty_words * height);
+    array_reserve(g_term_fb_dirty_x0, height);
+    array_reserve(g_term_fb_dirty_x1, height);
+    array_reserve(g_term_fb_dirty_rows, ((usize)height + 63) / 64);
+    memset(g_term_fb_dirty, 0, array_size(g_term_fb_dirty));
+    memset(g_term_fb_dirty_rows, 0, array_size(g_term_fb_dirty_rows));
+    for (u16 y = 0; y < height; ++y) {
+        g_term_fb_dirty_x0[y] = UINT16_MAX;
+        g_term_fb_dirty_x1[y] = 0;
+        _term_fb_mark_dirty(0, y, width);
+    }
 }
 
 internal void _term_fb_done(void)
 {
-    array_free(g_term_fb_chars);
-    array_free(g_term_fb_ink);
-    array_free(g_term_fb_paper);
+    if (g_term_fb_block) {
+        KORE_FREE(g_term_fb_block);
+    }
+    _term_fb_set_planes(NULL, 0);
+    g_term_fb_size = (TermSize){0};
     array_free(g_term_fb_dirty);
+    array_free(g_term_fb_dirty_x0);
+    array_free(g_term_fb_dirty_x1);
+    array_free(g_term_fb_dirty_rows);
+    array_free(g_term_fb_scrolls);
+    _term_present_done();
 }
 
 //------------------------------------------------------------------------------
@@ -835,6 +2283,99 @@ u32 term_blend(u32 dest, u32 src, f32 alpha)
     return term_rgb(out_r, out_g, out_b);
 }
 
+//------------------------------------------------------------------------------
+// Colour palettes
+
+// The standard xterm colours for the 16 ANSI palette entries.
+global_variable const u32 g_term_ansi_palette[16] = {
+    0x000000, 0xCD0000, 0x00CD00, 0xCDCD00, 0x0000EE, 0xCD00CD,
+    0x00CDCD, 0xE5E5E5, 0x7F7F7F, 0xFF0000, 0x00FF00, 0xFFFF00,
+    0x5C5CFF, 0xFF00FF, 0x00FFFF, 0xFFFFFF,
+};
+
+// Channel levels of the 6x6x6 colour cube in the xterm 256 colour palette.
+global_variable const u8 g_term_cube_levels[6] = {0, 95, 135, 175, 215, 255};
+
+// Direct-mapped cache in front of the nearest colour search so each distinct
+// colour is only searched for once.
+#    define TERM_PALETTE_CACHE_SIZE 1024
+
+typedef struct {
+    u32 key; // Colour mode in the top byte and RGB below, 0 means empty
+    u8  index;
+} TermPaletteCacheEntry;
+
+// Each thread has its own cache as frames may be encoded in parallel.
+global_variable thread_local TermPaletteCacheEntry
+    g_term_palette_cache[TERM_PALETTE_CACHE_SIZE];
+
+internal u32 _term_palette_colour(u32 index)
+{
+    if (index < 16) {
+        return g_term_ansi_palette[index];
+    }
+    if (index < 232) {
+        index -= 16;
+        return ((u32)g_term_cube_levels[index / 36] << 16) |
+               ((u32)g_term_cube_levels[(index / 6) % 6] << 8) |
+               (u32)g_term_cube_levels[index % 6];
+    }
+    u32 grey = 8 + (index - 232) * 10;
+    return (grey << 16) | (grey << 8) | grey;
+}
+
+internal u8 _term_palette_search(u32 colour, TermColourMode mode)
+{
+    // The first 16 entries of the 256 colour palette are often themed by the
+    // user, so we only match against the fixed cube and grey ramp.
+    u32 first = mode == TERM_COLOUR_16 ? 0 : 16;
+    u32 last  = mode == TERM_COLOUR_16 ? 16 : 256;
+
+    i32 r     = (colour >> 16) & 0xFF;
+    i32 g     = (colour >> 8) & 0xFF;
+    i32 b     = colour & 0xFF;
+
+    u32 best_index    = first;
+    u32 best_distance = UINT32_MAX;
+    for (u32 i = first; i < last; ++i) {
+        u32 entry    = _term_palette_colour(i);
+        i32 dr       = r - (i32)((entry >> 16) & 0xFF);
+        i32 dg       = g - (i32)((entry >> 8) & 0xFF);
+        i32 db       = b - (i32)(entry & 0xFF);
+        u32 distance = (u32)(2 * dr * dr + 4 * dg * dg + 3 * db * db);
+        if (distance < best_distance) {
+            best_distance = distance;
+            best_index    = i;
+        }
+    }
+
+    return (u8)best_index;
+}
+
+// Returns the palette index nearest to a colour for the given reduced mode.
+internal u8 _term_palette_index(u32 colour, TermColourMode mode)
+{
+    u32 key  = ((u32)mode << 24) | (colour & 0xFFFFFF);
+    u32 slot = (key * 2654435761u) >> 22; // 10 bits for 1024 entries
+
+    TermPaletteCacheEntry* entry = &g_term_palette_cache[slot];
+    if (entry->key != key) {
+        entry->key   = key;
+        entry->index = _term_palette_search(colour, mode);
+    }
+    return entry->index;
+}
+
+// Reduces a colour to what will actually be sent to the terminal, so that
+// colours that look the same on screen compare equal.
+internal u32 _term_colour_key(u32 colour, TermColourMode mode)
+{
+    if (mode == TERM_COLOUR_TRUE) {
+        return colour & 0xFFFFFF;
+    }
+    return _term_palette_index(colour, mode);
+}
+
 //------------------------------------------------------------------------------
 
 void term_fb_cls(u32 ink, u32 paper)
@@ -850,24 +2391,18 @@ void term_fb_clip_rect(TermRect  rect,
 {
     TermSize size = g_term_fb_size;
 
-    // Clip the rectangle to the framebuffer size
-    u16 x0        = rect.x;
-    u16 y0        = rect.y;
-    u16 x1        = rect.x + rect.width;
-    u16 y1        = rect.y + rect.height;
-
-    if (x0 < 0) {
-        x0 = 0;
-    }
-    if (y0 < 0) {
-        y0 = 0;
-    }
-    if (x1 > size.width) {
-        x1 = size.width;
-    }
-    if (y1 > size.height) {
-        y1 = size.height;
+    // Clip the rectangle to the framebuffer size.  A rectangle starting off
+    // the framebuffer clips to nothing, and the far edges are found in u32 so
+    // that they cannot wrap around.
+    if (rect.x >= size.width || rect.y >= size.height) {
+        *out_clipped_rect = (TermRect){0};
+        *out_local_rect   = (TermRect){0};
+        return;
     }
+    u16 x0 = rect.x;
+    u16 y0 = rect.y;
+    u16 x1 = (u16)KORE_MIN((u32)rect.x + rect.width, (u32)size.width);
+    u16 y1 = (u16)KORE_MIN((u32)rect.y + rect.height, (u32)size.height);
 
     // Output the clipped rectangle
     out_clipped_rect->x      = x0;
@@ -882,134 +2417,585 @@ void term_fb_clip_rect(TermRect  rect,
     out_local_rect->height   = out_clipped_rect->height;
 }
 
-void term_fb_rect_ink(TermRect rect, u32 colour)
+// Fills `count` u32s with the same value.
+internal void _term_fill_u32(u32* dst, u32 value, usize count)
 {
-    TermRect clipped_rect, local_rect;
-    term_fb_clip_rect(rect, &clipped_rect, &local_rect);
-
-    for (u16 y = 0; y < clipped_rect.height; y++) {
-        for (u16 x = 0; x < clipped_rect.width; x++) {
-            usize index = (clipped_rect.y + y) * g_term_fb_size.width +
-                          (clipped_rect.x + x);
-            g_term_fb_ink[index]   = colour;
-            g_term_fb_dirty[index] = 1;
-        }
+    usize i = 0;
+
+#        if TERM_SIMD_AVX2
+    __m256i wide = _mm256_set1_epi32((int)value);
+    for (; i + 32 <= count; i += 32) {
+        _mm256_storeu_si256((__m256i*)(dst + i), wide);
+        _mm256_storeu_si256((__m256i*)(dst + i + 8), wide);
+        _mm256_storeu_si256((__m256i*)(dst + i + 16), wide);
+        _mm256_storeu_si256((__m256i*)(dst + i + 24), wide);
     }
-}
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256((__m256i*)(dst + i), wide);
+    }
+#        endif
 
-void term_fb_rect_paper(TermRect rect, u32 colour)
-{
-    TermRect clipped_rect, local_rect;
-    term_fb_clip_rect(rect, &clipped_rect, &local_rect);
+#        if TERM_SIMD_SSE2
+    __m128i narrow = _mm_set1_epi32((int)value);
+    for (; i + 16 <= count; i += 16) {
+        _mm_storeu_si128((__m128i*)(dst + i), narrow);
+        _mm_storeu_si128((__m128i*)(dst + i + 4), narrow);
+        _mm_storeu_si128((__m128i*)(dst + i + 8), narrow);
+        _mm_storeu_si128((__m128i*)(dst + i + 12), narrow);
+    }
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128((__m128i*)(dst + i), narrow);
+    }
+#        endif
 
-    for (u16 y = 0; y < clipped_rect.height; y++) {
-        for (u16 x = 0; x < clipped_rect.width; x++) {
-            usize index = (clipped_rect.y + y) * g_term_fb_size.width +
-                          (clipped_rect.x + x);
-            g_term_fb_paper[index] = colour;
-            g_term_fb_dirty[index] = 1;
-        }
+    for (; i < count; ++i) {
+        dst[i] = value;
     }
 }
 
-void term_fb_rect_colour(TermRect rect, u32 ink, u32 paper)
+#    if TERM_FB_INTERLEAVED
+
+// Fills `count` cells with the same value.
+internal void _term_fill_cells(TermCell* dst, TermCell value, usize count)
 {
-    TermRect clipped_rect, local_rect;
-    term_fb_clip_rect(rect, &clipped_rect, &local_rect);
+    usize i = 0;
+
+#        if TERM_SIMD_AVX2
+    __m256i wide = _mm256_setr_epi32((int)value.ch,
+                                     (int)value.ink,
+                                     (int)value.paper,
+                                     (int)value.flags,
+                                     (int)value.ch,
+                                     (int)value.ink,
+                                     (int)value.paper,
+                                     (int)value.flags);
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256((__m256i*)(dst + i), wide);
+        _mm256_storeu_si256((__m256i*)(dst + i + 2), wide);
+        _mm256_storeu_si256((__m256i*)(dst + i + 4), wide);
+        _mm256_storeu_si256((__m256i*)(dst + i + 6), wide);
+    }
+#        endif
 
-    for (u16 y = 0; y < clipped_rect.height; y++) {
+#        if TERM_SIMD_SSE2
+    __m128i narrow = _mm_setr_epi32(
+        (int)value.ch, (int)value.ink, (int)value.paper, (int)value.flags);
+    for (; i < count; ++i) {
+        _mm_storeu_si128((__m128i*)(dst + i), narrow);
+    }
+#        endif
+
+    for (; i < count; ++i) {
+        dst[i] = value;
+    }
+}
+
+internal void _term_fb_fill_rect(
+    TermRect clipped_rect, u32 fields, u32 ch, u32 ink, u32 paper)
+{
+    usize     width = g_term_fb_size.width;
+    TermCell* dst =
+        g_term_fb_cells + (usize)clipped_rect.y * width + clipped_rect.x;
+
+    if (fields == TERM_FB_FILL_ALL) {
+        TermCell cell = {.ch = ch, .ink = ink, .paper = paper};
+        if (clipped_rect.width == width) {
+            _term_fill_cells(dst, cell, width * clipped_rect.height);
+        } else {
+            for (u16 y = 0; y < clipped_rect.height; y++, dst += width) {
+                _term_fill_cells(dst, cell, clipped_rect.width);
+            }
+        }
+        return;
+    }
+
+    // Only some of each cell is written, so the fill is strided.
+    for (u16 y = 0; y < clipped_rect.height; y++, dst += width) {
         for (u16 x = 0; x < clipped_rect.width; x++) {
-            usize index = (clipped_rect.y + y) * g_term_fb_size.width +
-                          (clipped_rect.x + x);
-            g_term_fb_ink[index]   = ink;
-            g_term_fb_paper[index] = paper;
-            g_term_fb_dirty[index] = 1;
+            if (fields & TERM_FB_FILL_CH) {
+                dst[x].ch = ch;
+            }
+            if (fields & TERM_FB_FILL_INK) {
+                dst[x].ink = ink;
+            }
+            if (fields & TERM_FB_FILL_PAPER) {
+                dst[x].paper = paper;
+            }
         }
     }
 }
 
-void term_fb_rect_char(TermRect rect, u32 ch)
+#    else
+
+// Fills a clipped rectangle of one framebuffer plane.  Rectangles spanning
+// the full width are contiguous in memory and are filled in one go.
+internal void _term_fb_fill_plane(u32* plane, TermRect clipped_rect, u32 value)
+{
+    usize width = g_term_fb_size.width;
+    u32*  dst   = plane + (usize)clipped_rect.y * width + clipped_rect.x;
+
+    if (clipped_rect.width == width) {
+        _term_fill_u32(dst, value, width * clipped_rect.height);
+    } else {
+        for (u16 y = 0; y < clipped_rect.height; y++, dst += width) {
+            _term_fill_u32(dst, value, clipped_rect.width);
+        }
+    }
+}
+
+internal void _term_fb_fill_rect(
+    TermRect clipped_rect, u32 fields, u32 ch, u32 ink, u32 paper)
+{
+    if (fields & TERM_FB_FILL_CH) {
+        _term_fb_fill_plane(g_term_fb_chars, clipped_rect, ch);
+    }
+    if (fields & TERM_FB_FILL_INK) {
+        _term_fb_fill_plane(g_term_fb_ink, clipped_rect, ink);
+    }
+    if (fields & TERM_FB_FILL_PAPER) {
+        _term_fb_fill_plane(g_term_fb_paper, clipped_rect, paper);
+    }
+}
+
+#    endif // TERM_FB_INTERLEAVED
+
+// Marks the front cells of some rows as unknown so that they are repainted.
+internal void _term_fb_invalidate_front_rows(u16 y, u16 rows)
+{
+    usize index = (usize)y * g_term_fb_size.width;
+    usize count = (usize)rows * g_term_fb_size.width;
+#    if TERM_FB_INTERLEAVED
+    _term_fill_cells(g_term_fb_front_cells + index,
+                     (TermCell){.ch = TERM_FB_CHAR_INVALID},
+                     count);
+#    else
+    _term_fill_u32(g_term_fb_front_chars + index, TERM_FB_CHAR_INVALID, count);
+#    endif
+}
+
+// Marks every front cell as unknown so that the whole screen is repainted.
+internal void _term_fb_invalidate_front(void)
+{
+    _term_fb_invalidate_front_rows(0, g_term_fb_size.height);
+}
+
+// Clips a rectangle, fills the requested parts of its cells and marks them
+// dirty.
+internal void _term_fb_rect_fill(
+    TermRect rect, u32 fields, u32 ch, u32 ink, u32 paper)
 {
     TermRect clipped_rect, local_rect;
     term_fb_clip_rect(rect, &clipped_rect, &local_rect);
 
+    _term_fb_fill_rect(clipped_rect, fields, ch, ink, paper);
     for (u16 y = 0; y < clipped_rect.height; y++) {
-        for (u16 x = 0; x < clipped_rect.width; x++) {
-            usize index = (clipped_rect.y + y) * g_term_fb_size.width +
-                          (clipped_rect.x + x);
-            g_term_fb_chars[index] = ch;
-            g_term_fb_dirty[index] = 1;
-        }
+        _term_fb_mark_dirty(
+            clipped_rect.x, clipped_rect.y + y, clipped_rect.width);
     }
 }
 
+void term_fb_rect_ink(TermRect rect, u32 colour)
+{
+    _term_fb_rect_fill(rect, TERM_FB_FILL_INK, 0, colour, 0);
+}
+
+void term_fb_rect_paper(TermRect rect, u32 colour)
+{
+    _term_fb_rect_fill(rect, TERM_FB_FILL_PAPER, 0, 0, colour);
+}
+
+void term_fb_rect_colour(TermRect rect, u32 ink, u32 paper)
+{
+    _term_fb_rect_fill(rect, TERM_FB_FILL_COLOUR, 0, ink, paper);
+}
+
+void term_fb_rect_char(TermRect rect, u32 ch)
+{
+    _term_fb_rect_fill(rect, TERM_FB_FILL_CH, ch, 0, 0);
+}
+
 void term_fb_rect(TermRect rect, u32 ch, u32 ink, u32 paper)
+{
+    _term_fb_rect_fill(rect, TERM_FB_FILL_ALL, ch, ink, paper);
+}
+
+//------------------------------------------------------------------------------
+// Translucent colours
+//
+// Each channel is blended with 8-bit integer maths as
+//
+//      (src * a + dst * (255 - a)) / 255
+//
+// rounded to nearest, where `a` is the alpha of the colour laid over.  The
+// products fit in 16 bits, so the SIMD kernels widen each colour's bytes to
+// 16-bit lanes.  The alpha channel is blended as though the source's were
+// 255, so the result is opaque wherever the destination was.
+
+// Divides x by 255, rounding to nearest, for x up to 255 * 255.
+internal u32 _term_div255(u32 x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Blends `src` over `dst` by the alpha of `src`.
+internal u32 _term_blend_over(u32 dst, u32 src)
+{
+    u32 alpha = src >> 24;
+    u32 out   = 0;
+    src |= 0xFF000000;
+    for (u32 shift = 0; shift < 32; shift += 8) {
+        u32 s = (src >> shift) & 0xFF;
+        u32 d = (dst >> shift) & 0xFF;
+        out |= _term_div255(s * alpha + d * (255 - alpha)) << shift;
+    }
+    return out;
+}
+
+// The SIMD kernels work along the rows of the planes.  The interleaved layout
+// blends cell by cell.
+#    if !TERM_FB_INTERLEAVED
+
+#        if TERM_SIMD_AVX2
+
+internal __m256i _term_div255_epi16_avx2(__m256i x)
+{
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+// Blends 8 colours towards a constant colour, already multiplied by its
+// alpha and widened, leaving one multiply and add per channel.
+internal __m256i
+_term_blend_premul_avx2(__m256i dst, __m256i premul, __m256i inverse)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo   = _mm256_unpacklo_epi8(dst, zero);
+    __m256i hi   = _mm256_unpackhi_epi8(dst, zero);
+    lo = _mm256_add_epi16(_mm256_mullo_epi16(lo, inverse), premul);
+    hi = _mm256_add_epi16(_mm256_mullo_epi16(hi, inverse), premul);
+    return _mm256_packus_epi16(_term_div255_epi16_avx2(lo),
+                               _term_div255_epi16_avx2(hi));
+}
+
+// Widens the colours in half of each 128-bit lane and blends the source ones
+// over the destination ones by their own alphas.
+internal __m256i _term_blend_over_half_avx2(__m256i dst, __m256i src)
+{
+    __m256i opaque = _mm256_set1_epi16(0xFF);
+    __m256i alpha  = _mm256_shufflehi_epi16(
+        _mm256_shufflelo_epi16(src, _MM_SHUFFLE(3, 3, 3, 3)),
+        _MM_SHUFFLE(3, 3, 3, 3));
+    __m256i inverse = _mm256_sub_epi16(opaque, alpha);
+    src = _mm256_or_si256(src, _mm256_set1_epi64x(0x00FF000000000000ll));
+    return _term_div255_epi16_avx2(
+        _mm256_add_epi16(_mm256_mullo_epi16(src, alpha),
+                         _mm256_mullo_epi16(dst, inverse)));
+}
+
+// Blends 8 colours over 8 others, each by its own alpha.
+internal __m256i _term_blend_over_avx2(__m256i dst, __m256i src)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo   = _term_blend_over_half_avx2(_mm256_unpacklo_epi8(dst, zero),
+                                            _mm256_unpacklo_epi8(src, zero));
+    __m256i hi   = _term_blend_over_half_avx2(_mm256_unpackhi_epi8(dst, zero),
+                                            _mm256_unpackhi_epi8(src, zero));
+    return _mm256_packus_epi16(lo, hi);
+}
+
+#        endif // TERM_SIMD_AVX2
+
+#        if TERM_SIMD_SSE2
+
+internal __m128i _term_div255_epi16(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+internal __m128i
+_term_blend_premul_sse2(__m128i dst, __m128i premul, __m128i inverse)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo   = _mm_unpacklo_epi8(dst, zero);
+    __m128i hi   = _mm_unpackhi_epi8(dst, zero);
+    lo           = _mm_add_epi16(_mm_mullo_epi16(lo, inverse), premul);
+    hi           = _mm_add_epi16(_mm_mullo_epi16(hi, inverse), premul);
+    return _mm_packus_epi16(_term_div255_epi16(lo), _term_div255_epi16(hi));
+}
+
+internal __m128i _term_blend_over_half_sse2(__m128i dst, __m128i src)
+{
+    __m128i opaque  = _mm_set1_epi16(0xFF);
+    __m128i alpha   = _mm_shufflehi_epi16(
+        _mm_shufflelo_epi16(src, _MM_SHUFFLE(3, 3, 3, 3)),
+        _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i inverse = _mm_sub_epi16(opaque, alpha);
+    src = _mm_or_si128(src, _mm_set1_epi64x(0x00FF000000000000ll));
+    return _term_div255_epi16(_mm_add_epi16(_mm_mullo_epi16(src, alpha),
+                                            _mm_mullo_epi16(dst, inverse)));
+}
+
+internal __m128i _term_blend_over_sse2(__m128i dst, __m128i src)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo   = _term_blend_over_half_sse2(_mm_unpacklo_epi8(dst, zero),
+                                            _mm_unpacklo_epi8(src, zero));
+    __m128i hi   = _term_blend_over_half_sse2(_mm_unpackhi_epi8(dst, zero),
+                                            _mm_unpackhi_epi8(src, zero));
+    return _mm_packus_epi16(lo, hi);
+}
+
+#        endif // TERM_SIMD_SSE2
+
+// Blends one colour over `count` colours.
+internal void _term_blend_u32(u32* dst, u32 colour, usize count)
+{
+    usize i     = 0;
+    u32   alpha = colour >> 24;
+    u32   solid = colour | 0xFF000000;
+
+#        if TERM_SIMD_AVX2
+    __m256i wide_inverse = _mm256_set1_epi16((short)(255 - alpha));
+    __m256i wide_premul  = _mm256_mullo_epi16(
+        _mm256_unpacklo_epi8(_mm256_set1_epi32((int)solid),
+                             _mm256_setzero_si256()),
+        _mm256_set1_epi16((short)alpha));
+    for (; i + 8 <= count; i += 8) {
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256(
+            (__m256i*)(dst + i),
+            _term_blend_premul_avx2(d, wide_premul, wide_inverse));
+    }
+#        endif
+
+#        if TERM_SIMD_SSE2
+    __m128i inverse = _mm_set1_epi16((short)(255 - alpha));
+    __m128i premul  = _mm_mullo_epi16(
+        _mm_unpacklo_epi8(_mm_set1_epi32((int)solid), _mm_setzero_si128()),
+        _mm_set1_epi16((short)alpha));
+    for (; i + 4 <= count; i += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i),
+                         _term_blend_premul_sse2(d, premul, inverse));
+    }
+#        endif
+
+    for (; i < count; ++i) {
+        dst[i] = _term_blend_over(dst[i], colour);
+    }
+}
+
+#    endif // !TERM_FB_INTERLEAVED
+
+internal void
+_term_fb_rect_blend(TermRect rect, bool blend_ink, u32 colour)
 {
     TermRect clipped_rect, local_rect;
     term_fb_clip_rect(rect, &clipped_rect, &local_rect);
+    if ((colour >> 24) == 0 || clipped_rect.width == 0) {
+        return;
+    }
 
     for (u16 y = 0; y < clipped_rect.height; y++) {
-        for (u16 x = 0; x < clipped_rect.width; x++) {
-            usize index = (clipped_rect.y + y) * g_term_fb_size.width +
-                          (clipped_rect.x + x);
-            g_term_fb_chars[index] = ch;
-            g_term_fb_ink[index]   = ink;
-            g_term_fb_paper[index] = paper;
-            g_term_fb_dirty[index] = 1;
+        usize index = (usize)(clipped_rect.y + y) * g_term_fb_size.width +
+                      clipped_rect.x;
+#    if TERM_FB_INTERLEAVED
+        TermCell* cells = g_term_fb_cells + index;
+        for (u16 i = 0; i < clipped_rect.width; ++i) {
+            if (blend_ink) {
+                cells[i].ink = _term_blend_over(cells[i].ink, colour);
+            }
+            cells[i].paper = _term_blend_over(cells[i].paper, colour);
         }
+#    else
+        if (blend_ink) {
+            _term_blend_u32(g_term_fb_ink + index, colour, clipped_rect.width);
+        }
+        _term_blend_u32(g_term_fb_paper + index, colour, clipped_rect.width);
+#    endif // TERM_FB_INTERLEAVED
+
+        _term_fb_mark_dirty(
+            clipped_rect.x, clipped_rect.y + y, clipped_rect.width);
     }
 }
 
-void term_utf8_next(cstr* s, u32* out_char, usize* out_bytes, usize* out_width)
+void term_fb_rect_blend(TermRect rect, u32 colour)
 {
-    const u8* ptr = (const u8*)(*s);
-    u8        b0  = ptr[0];
+    _term_fb_rect_blend(rect, true, colour);
+}
 
-    if (b0 == '\0') {
-        *out_char  = 0;
-        *out_bytes = 0;
-        *out_width = 0;
+void term_fb_blend_paper(TermRect rect, u32 colour)
+{
+    _term_fb_rect_blend(rect, false, colour);
+}
+
+//------------------------------------------------------------------------------
+// Scrolling
+
+// Moves `rows` rows of the columns [x, x + width) within one plane.
+internal void _term_fb_shift_rows(
+    u8* plane, u16 x, u16 width, u16 dst_y, u16 src_y, u16 rows)
+{
+    usize pitch = g_term_fb_size.width * TERM_FB_CELL_SIZE;
+    usize bytes = width * TERM_FB_CELL_SIZE;
+    u8*   dst   = plane + dst_y * pitch + x * TERM_FB_CELL_SIZE;
+    u8*   src   = plane + src_y * pitch + x * TERM_FB_CELL_SIZE;
+
+    if (width == g_term_fb_size.width) {
+        // Full rows are contiguous.
+        memmove(dst, src, rows * pitch);
+    } else if (dst_y < src_y) {
+        for (u16 y = 0; y < rows; ++y) {
+            memmove(dst + y * pitch, src + y * pitch, bytes);
+        }
+    } else {
+        for (u16 y = rows; y-- > 0;) {
+            memmove(dst + y * pitch, src + y * pitch, bytes);
+        }
+    }
+}
+
+// Queues a scroll for the terminal to perform at the next present.
+// Consecutive scrolls of the same region in the same direction are combined.
+internal void _term_fb_queue_scroll(u16 top, u16 bottom, int dy)
+{
+    usize count = array_count(g_term_fb_scrolls);
+    if (count > 0) {
+        TermScroll* last = &g_term_fb_scrolls[count - 1];
+        if (last->top == top && last->bottom == bottom &&
+            (last->dy > 0) == (dy > 0)) {
+            int total = KORE_MIN(abs(last->dy + dy), bottom - top);
+            last->dy  = (i16)(dy > 0 ? total : -total);
+            return;
+        }
+    }
+    array_push(g_term_fb_scrolls, (TermScroll){top, bottom, (i16)dy});
+}
+
+void term_fb_scroll(TermRect rect, int dy)
+{
+    TermRect clipped_rect, local_rect;
+    term_fb_clip_rect(rect, &clipped_rect, &local_rect);
+
+    u16 height = clipped_rect.height;
+    if (dy == 0 || clipped_rect.width == 0 || height == 0) {
         return;
     }
 
-    u32   ch    = 0;
-    usize bytes = 1;
+    u16      distance = (u16)KORE_MIN(abs(dy), (int)height);
+    u16      kept     = height - distance;
+    u16      top      = clipped_rect.y;
+    u16      src_y    = dy > 0 ? top + distance : top;
+    u16      dst_y    = dy > 0 ? top : top + distance;
+    TermRect exposed  = {clipped_rect.x,
+                         dy > 0 ? top + kept : top,
+                         clipped_rect.width,
+                         distance};
+
+    // Only full rows can be scrolled by the terminal.  The front buffer is
+    // scrolled along with the back buffer so the cells keep comparing equal
+    // and only the exposed rows are repainted.
+    bool by_terminal  = clipped_rect.width == g_term_fb_size.width && kept > 0;
+    usize planes      = by_terminal ? TERM_FB_PLANES : TERM_FB_BACK_PLANES;
+    usize plane_bytes = g_term_fb_capacity * TERM_FB_CELL_SIZE;
+
+    if (kept > 0) {
+        for (usize plane = 0; plane < planes; ++plane) {
+            _term_fb_shift_rows(g_term_fb_block + plane * plane_bytes,
+                                clipped_rect.x,
+                                clipped_rect.width,
+                                dst_y,
+                                src_y,
+                                kept);
+        }
+    }
+
+    if (by_terminal) {
+        // Dirty cells move with their rows.
+        if (dy > 0) {
+            for (u16 y = 0; y < kept; ++y) {
+                _term_fb_copy_dirty_row(dst_y + y, src_y + y);
+            }
+        } else {
+            for (u16 y = kept; y-- > 0;) {
+                _term_fb_copy_dirty_row(dst_y + y, src_y + y);
+            }
+        }
+        _term_fb_invalidate_front_rows(exposed.y, exposed.height);
+        _term_fb_queue_scroll(top, top + height, dy > 0 ? distance : -distance);
+    }
+
+    _term_fb_fill_rect(exposed, TERM_FB_FILL_CH, ' ', 0, 0);
+
+    // Without the terminal's help every moved cell has to be sent again.
+    TermRect dirty = by_terminal ? exposed : clipped_rect;
+    for (u16 y = 0; y < dirty.height; ++y) {
+        _term_fb_mark_dirty(dirty.x, dirty.y + y, dirty.width);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+int term_char_width(u32 ch)
+{
+    if (ch < 0x7F) {
+        return ch >= 0x20 ? 1 : ch == 0 ? 0 : -1;
+    }
+    if (ch >= 0x110000) {
+        return -1;
+    }
+
+    // Two loads: the character's block, then its 2-bit width code.  Code 3
+    // marks control characters.
+    u32   offset = ch & ((1u << TERM_WIDTH_BLOCK_BITS) - 1);
+    usize block  = g_term_width_stage1[ch >> TERM_WIDTH_BLOCK_BITS];
+    usize index  = (block << TERM_WIDTH_BLOCK_BITS) + offset;
+    int   code   = (g_term_width_stage2[index >> 2] >> ((index & 3) * 2)) & 3;
+    return code == 3 ? -1 : code;
+}
+
+// Decodes the UTF-8 sequence at the start of `size` bytes, returning the
+// number of bytes used.  Invalid or truncated sequences decode as a single
+// byte space.
+internal usize _term_utf8_decode(const u8* ptr, usize size, u32* out_char)
+{
+    u8 b0 = ptr[0];
 
     if (b0 < 0x80) {
-        ch = b0;
-    } else if ((b0 & 0xE0) == 0xC0) {
-        u8 b1 = ptr[1];
-        if (b1 == '\0' || (b1 & 0xC0) != 0x80) {
+        *out_char = b0;
+        return 1;
+    }
+
+    u32   ch    = 0;
+    usize bytes = 0;
+    if ((b0 & 0xE0) == 0xC0) {
+        if (size < 2 || (ptr[1] & 0xC0) != 0x80) {
             goto invalid;
         }
-        ch    = ((u32)(b0 & 0x1F) << 6) | (u32)(b1 & 0x3F);
+        ch    = ((u32)(b0 & 0x1F) << 6) | (u32)(ptr[1] & 0x3F);
         bytes = 2;
         if (ch < 0x80) {
             goto invalid;
         }
     } else if ((b0 & 0xF0) == 0xE0) {
-        u8 b1 = ptr[1];
-        u8 b2 = ptr[2];
-        if (b1 == '\0' || b2 == '\0' || (b1 & 0xC0) != 0x80 ||
-            (b2 & 0xC0) != 0x80) {
+        if (size < 3 || (ptr[1] & 0xC0) != 0x80 || (ptr[2] & 0xC0) != 0x80) {
             goto invalid;
         }
-        ch = ((u32)(b0 & 0x0F) << 12) | ((u32)(b1 & 0x3F) << 6) |
-             (u32)(b2 & 0x3F);
+        ch = ((u32)(b0 & 0x0F) << 12) | ((u32)(ptr[1] & 0x3F) << 6) |
+             (u32)(ptr[2] & 0x3F);
         bytes = 3;
         if (ch < 0x800 || (ch >= 0xD800 && ch <= 0xDFFF)) {
             goto invalid;
         }
     } else if ((b0 & 0xF8) == 0xF0) {
-        u8 b1 = ptr[1];
-        u8 b2 = ptr[2];
-        u8 b3 = ptr[3];
-        if (b1 == '\0' || b2 == '\0' || b3 == '\0' || (b1 & 0xC0) != 0x80 ||
-            (b2 & 0xC0) != 0x80 || (b3 & 0xC0) != 0x80) {
+        if (size < 4 || (ptr[1] & 0xC0) != 0x80 || (ptr[2] & 0xC0) != 0x80 ||
+            (ptr[3] & 0xC0) != 0x80) {
             goto invalid;
         }
-        ch = ((u32)(b0 & 0x07) << 18) | ((u32)(b1 & 0x3F) << 12) |
-             ((u32)(b2 & 0x3F) << 6) | (u32)(b3 & 0x3F);
+        ch = ((u32)(b0 & 0x07) << 18) | ((u32)(ptr[1] & 0x3F) << 12) |
+             ((u32)(ptr[2] & 0x3F) << 6) | (u32)(ptr[3] & 0x3F);
         bytes = 4;
         if (ch < 0x10000 || ch > 0x10FFFF) {
             goto invalid;
@@ -1018,42 +3004,146 @@ void term_utf8_next(cstr* s, u32* out_char, usize* out_bytes, usize* out_width)
         goto invalid;
     }
 
-    *out_char  = ch;
-    *out_bytes = bytes;
+    *out_char = ch;
+    return bytes;
 
-    int width  = wcwidth((wchar_t)ch);
-    if (width <= 0) {
-        width = 1;
+invalid:
+    *out_char = (u32)' ';
+    return 1;
+}
+
+void term_utf8_next(cstr* s, u32* out_char, usize* out_bytes, usize* out_width)
+{
+    const u8* ptr = (const u8*)(*s);
+
+    if (ptr[0] == '\0') {
+        *out_char  = 0;
+        *out_bytes = 0;
+        *out_width = 0;
+        return;
     }
-    *out_width = (usize)width;
 
+    // A NUL terminator cuts a sequence short just like the end of a buffer.
+    usize bytes = _term_utf8_decode(ptr, strnlen(*s, 4), out_char);
+    int   width = term_char_width(*out_char);
+
+    *out_bytes  = bytes;
+    *out_width  = width <= 0 ? 1 : (usize)width;
     (*s) += bytes;
-    return;
+}
 
-invalid:
-    *out_char  = (u32)' ';
-    *out_bytes = 1;
-    *out_width = 1;
-    (*s)++;
+// Returns the length of the run of ASCII characters, other than newlines, at
+// the start of `size` bytes.  The run is found 32 or 16 bytes at a time.
+internal usize _term_ascii_run(const u8* data, usize size)
+{
+    usize i = 0;
+
+#    if TERM_SIMD_AVX2
+    __m256i newlines = _mm256_set1_epi8('\n');
+    for (; i + 32 <= size; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(data + i));
+        u32     stops = (u32)_mm256_movemask_epi8(bytes) |
+                    (u32)_mm256_movemask_epi8(
+                        _mm256_cmpeq_epi8(bytes, newlines));
+        if (stops != 0) {
+            return i + bits_ctz_u64(stops);
+        }
+    }
+#    endif
+
+#    if TERM_SIMD_SSE2
+    __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= size; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(data + i));
+        u32     stops = (u32)_mm_movemask_epi8(bytes) |
+                    (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+        if (stops != 0) {
+            return i + bits_ctz_u64(stops);
+        }
+    }
+#    endif
+
+    for (; i < size; ++i) {
+        if (data[i] >= 0x80 || data[i] == '\n') {
+            break;
+        }
+    }
+    return i;
 }
 
-void term_fb_write(u16 x, u16 y, cstr string)
+// Stores a run of ASCII characters into consecutive cells, widening each
+// byte to a code point.
+internal void _term_fb_store_ascii(usize index, const u8* data, usize count)
 {
-    TermSize size      = g_term_fb_size;
-    u16      fb_width  = size.width;
-    u16      fb_height = size.height;
-    u16      cx        = x;
-    u16      cy        = y;
+    usize i = 0;
+
+#    if TERM_FB_INTERLEAVED
+    for (; i < count; ++i) {
+        g_term_fb_cells[index + i].ch = data[i];
+    }
+#    else
+    u32* dst = g_term_fb_chars + index;
+
+#        if TERM_SIMD_AVX2
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_cvtepu8_epi32(bytes));
+        _mm256_storeu_si256((__m256i*)(dst + i + 8),
+                            _mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)));
+    }
+#        elif TERM_SIMD_SSE2
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i lo    = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi    = _mm_unpackhi_epi8(bytes, zero);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i*)(dst + i + 12),
+                         _mm_unpackhi_epi16(hi, zero));
+    }
+#        endif
 
-    if (fb_width == 0 || fb_height == 0) {
+    for (; i < count; ++i) {
+        dst[i] = data[i];
+    }
+#    endif // TERM_FB_INTERLEAVED
+}
+
+internal void _term_fb_write_bytes(u16 x, u16 y, const u8* data, usize length)
+{
+    TermSize  size      = g_term_fb_size;
+    u16       fb_width  = size.width;
+    u16       fb_height = size.height;
+    u16       cx        = x;
+    u16       cy        = y;
+    const u8* end       = data + length;
+
+    // Text wraps back to x, so none of it fits if x is off the right edge.
+    if (x >= fb_width || fb_height == 0) {
         return;
     }
 
-    while (*string != '\0' && cy < fb_height) {
-        u32   ch;
-        usize bytes;
-        usize width;
-        term_utf8_next(&string, &ch, &bytes, &width);
+    while (data < end && cy < fb_height) {
+        // Runs of ASCII characters are copied to the row in bulk.
+        if (*data < 0x80 && *data != '\n' && cx < fb_width) {
+            usize room = KORE_MIN((usize)(fb_width - cx), (usize)(end - data));
+            usize run  = _term_ascii_run(data, room);
+            _term_fb_store_ascii((usize)cy * fb_width + cx, data, run);
+            _term_fb_mark_dirty(cx, cy, (u16)run);
+
+            data += run;
+            cx += (u16)run;
+            if (cx >= fb_width) {
+                cx = x;
+                cy += 1;
+            }
+            continue;
+        }
+
+        u32 ch;
+        data += _term_utf8_decode(data, (usize)(end - data), &ch);
 
         if (ch == '\n') {
             cx = x;
@@ -1061,9 +3151,9 @@ void term_fb_write(u16 x, u16 y, cstr string)
             continue;
         }
 
-        if (width == 0) {
-            width = 1;
-        } else if (width > fb_width) {
+        int   char_width = term_char_width(ch);
+        usize width      = char_width <= 0 ? 1 : (usize)char_width;
+        if (width > fb_width) {
             width = fb_width;
         }
 
@@ -1087,20 +3177,19 @@ void term_fb_write(u16 x, u16 y, cstr string)
             }
         }
 
-        usize row_start        = (usize)cy * fb_width;
-        usize index            = row_start + cx;
-        g_term_fb_chars[index] = ch;
-        g_term_fb_dirty[index] = 1;
+        usize row_start   = (usize)cy * fb_width;
+        usize index       = row_start + cx;
+        TERM_FB_CH(index) = ch;
 
         for (usize cell = 1; cell < width; ++cell) {
             u16 tail_x = (u16)(cx + cell);
             if (tail_x >= fb_width) {
                 break;
             }
-            usize tail_index            = row_start + tail_x;
-            g_term_fb_chars[tail_index] = TERM_FB_CHAR_WIDE_TAIL;
-            g_term_fb_dirty[tail_index] = 1;
+            usize tail_index       = row_start + tail_x;
+            TERM_FB_CH(tail_index) = TERM_FB_CHAR_WIDE_TAIL;
         }
+        _term_fb_mark_dirty(cx, cy, (u16)width);
 
         cx += (u16)width;
         if (cx >= fb_width) {
@@ -1110,6 +3199,16 @@ void term_fb_write(u16 x, u16 y, cstr string)
     }
 }
 
+void term_fb_write(u16 x, u16 y, cstr string)
+{
+    _term_fb_write_bytes(x, y, (const u8*)string, strlen(string));
+}
+
+void term_fb_write_string(u16 x, u16 y, string text)
+{
+    _term_fb_write_bytes(x, y, text.data, text.count);
+}
+
 void term_fb_formatv(u16 x, u16 y, cstr fmt, va_list args)
 {
     arena_reset(&g_term_arena);
@@ -1127,112 +3226,2694 @@ void term_fb_format(u16 x, u16 y, cstr fmt, ...)
 }
 
 //------------------------------------------------------------------------------
-// Presentation
+// Canvases
 
-void term_fb_present(void)
+void term_canvas_init(TermCanvas* canvas, Arena* arena, u16 width, u16 height)
 {
-    TermSize size = g_term_fb_size;
-    arena_reset(&g_term_arena);
+    usize count  = (usize)width * height;
+    u32*  planes = (u32*)arena_alloc_align(arena, count * 3 * sizeof(u32), 32);
 
-    // We go through each row to detect sequence of dirty characters and
-    // consecutive ink and paper colours.
-    //
-    // Each sequence starts with a CURSOR_GOTO or CURSOR_RIGHT code so that
-    // the cursor is at the beginning of the changed area.  Then for a
-    // single sequence of same ink and paper, the ANSI attributes are
-    // written to set the colours followed by the characters.
-    //
-    // The u32 characters are encoded into a UTF-8 sequence.
-    //
-    // When a row is complete, the next row is done.
+    canvas->width  = width;
+    canvas->height = height;
+    canvas->chars  = planes;
+    canvas->ink    = planes + count;
+    canvas->paper  = planes + count * 2;
 
-    u16 last_x = 0;
-    u16 last_y = 0;
+    _term_fill_u32(canvas->chars, ' ', count);
+    memset(canvas->ink, 0, count * 2 * sizeof(u32));
+}
 
-    if (g_cursor_visible) {
-        term_cursor_hide();
+// Clips a rectangle to a canvas, returning false if nothing is left.
+internal bool _term_canvas_clip(const TermCanvas* canvas, TermRect* rect)
+{
+    if (rect->x >= canvas->width || rect->y >= canvas->height) {
+        return false;
     }
+    rect->width  = KORE_MIN(rect->width, (u16)(canvas->width - rect->x));
+    rect->height = KORE_MIN(rect->height, (u16)(canvas->height - rect->y));
+    return rect->width > 0 && rect->height > 0;
+}
 
-    // Write home code
-    arena_format(&g_term_arena, "\x1b[H");
+internal void _term_canvas_fill_plane(const TermCanvas* canvas,
+                                      u32*              plane,
+                                      TermRect          rect,
+                                      u32               value)
+{
+    usize width = canvas->width;
+    u32*  dst   = plane + (usize)rect.y * width + rect.x;
 
-    for (u16 y = 0; y < size.height; ++y) {
-        u16 x          = 0;
-        u16 base_index = y * size.width;
-        while (x < size.width) {
-            // Find the start of the next dirty section
-            if (g_term_fb_dirty[base_index + x] == 0) {
-                x++;
-                continue;
-            }
+    if (rect.width == width) {
+        _term_fill_u32(dst, value, width * rect.height);
+    } else {
+        for (u16 y = 0; y < rect.height; y++, dst += width) {
+            _term_fill_u32(dst, value, rect.width);
+        }
+    }
+}
 
-            // Found the start of a dirty section
-            if (x != last_x || y != last_y) {
-                // Move the cursor to this position
-                arena_format(&g_term_arena, "\x1b[%d;%dH", y + 1, x + 1);
-            }
-            last_x    = x;
-            last_y    = y;
-
-            // Get the ink and paper for this section
-            u32 ink   = g_term_fb_ink[base_index + x];
-            u32 paper = g_term_fb_paper[base_index + x];
-            arena_format(&g_term_arena,
-                         "\x1b[38;2;%u;%u;%um",
-                         (ink >> 16) & 0xFF,
-                         (ink >> 8) & 0xFF,
-                         (ink >> 0) & 0xFF);
-            arena_format(&g_term_arena,
-                         "\x1b[48;2;%u;%u;%um",
-                         (paper >> 16) & 0xFF,
-                         (paper >> 8) & 0xFF,
-                         (paper >> 0) & 0xFF);
-
-            // Output characters until the ink/paper changes or we hit a
-            // clean section
-            while (x < size.width && g_term_fb_dirty[base_index + x] != 0 &&
-                   g_term_fb_ink[base_index + x] == ink &&
-                   g_term_fb_paper[base_index + x] == paper) {
-                u32 ch = g_term_fb_chars[base_index + x];
-
-                if (ch != (u32)TERM_FB_CHAR_WIDE_TAIL) {
-                    if (ch <= 0x7F) {
-                        arena_format(&g_term_arena, "%c", (char)(ch & 0x7F));
-                    } else if (ch <= 0x7FF) {
-                        arena_format(&g_term_arena,
-                                     "%c%c",
-                                     (char)(0xC0 | ((ch >> 6) & 0x1F)),
-                                     (char)(0x80 | (ch & 0x3F)));
-                    } else if (ch <= 0xFFFF) {
-                        arena_format(&g_term_arena,
-                                     "%c%c%c",
-                                     (char)(0xE0 | ((ch >> 12) & 0x0F)),
-                                     (char)(0x80 | ((ch >> 6) & 0x3F)),
-                                     (char)(0x80 | (ch & 0x3F)));
-                    } else {
-                        arena_format(&g_term_arena,
-                                     "%c%c%c%c",
-                                     (char)(0xF0 | ((ch >> 18) & 0x07)),
-                                     (char)(0x80 | ((ch >> 12) & 0x3F)),
-                                     (char)(0x80 | ((ch >> 6) & 0x3F)),
-                                     (char)(0x80 | (ch & 0x3F)));
-                    }
-                }
+void term_canvas_cls(TermCanvas* canvas, u32 ink, u32 paper)
+{
+    TermRect rect = {0, 0, canvas->width, canvas->height};
+    term_canvas_rect(canvas, rect, ' ', ink, paper);
+}
 
-                g_term_fb_dirty[base_index + x] = 0;
-                x++;
-                last_x++;
-            }
-        }
+void term_canvas_rect(
+    TermCanvas* canvas, TermRect rect, u32 ch, u32 ink, u32 paper)
+{
+    if (_term_canvas_clip(canvas, &rect)) {
+        _term_canvas_fill_plane(canvas, canvas->chars, rect, ch);
+        _term_canvas_fill_plane(canvas, canvas->ink, rect, ink);
+        _term_canvas_fill_plane(canvas, canvas->paper, rect, paper);
     }
+}
 
-    arena_null_terminate(&g_term_arena);
-    cstr output = (cstr)g_term_arena.memory;
-    if (g_cursor_visible) {
-        term_cursor_show();
+void term_canvas_rect_colour(TermCanvas* canvas,
+                             TermRect    rect,
+                             u32         ink,
+                             u32         paper)
+{
+    if (_term_canvas_clip(canvas, &rect)) {
+        _term_canvas_fill_plane(canvas, canvas->ink, rect, ink);
+        _term_canvas_fill_plane(canvas, canvas->paper, rect, paper);
+    }
+}
+
+// Writes text into a canvas, wrapping back to column x as term_fb_write does.
+void term_canvas_write_string(TermCanvas* canvas, u16 x, u16 y, string text)
+{
+    u16       width  = canvas->width;
+    u16       height = canvas->height;
+    u16       cx     = x;
+    u16       cy     = y;
+    const u8* data   = text.data;
+    const u8* end    = data + text.count;
+
+    while (data < end && cy < height) {
+        u32 ch;
+        data += _term_utf8_decode(data, (usize)(end - data), &ch);
+
+        int char_width = ch == '\n' ? 0 : term_char_width(ch);
+        u16 cells      = char_width == 2 ? 2 : 1;
+        if (ch == '\n' || cx + cells > width) {
+            // Move to the next line.  A character that cannot fit even at the
+            // start of a line is dropped.
+            cx = x;
+            cy += 1;
+            if (ch == '\n' || cy >= height || cx + cells > width) {
+                continue;
+            }
+        }
+
+        u32* dst = canvas->chars + (usize)cy * width + cx;
+        dst[0]   = ch;
+        if (cells == 2) {
+            dst[1] = TERM_FB_CHAR_WIDE_TAIL;
+        }
+        cx += cells;
+    }
+}
+
+void term_canvas_write(TermCanvas* canvas, u16 x, u16 y, cstr string)
+{
+    term_canvas_write_string(
+        canvas, x, y, string_from((u8*)string, strlen(string)));
+}
+
+void term_canvas_format(TermCanvas* canvas, u16 x, u16 y, cstr fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    arena_reset(&g_term_arena);
+    arena_formatv(&g_term_arena, fmt, args);
+    va_end(args);
+    term_canvas_write(canvas, x, y, (cstr)g_term_arena.memory);
+}
+
+void term_fb_blit(const TermCanvas* canvas, TermRect src_rect, u16 x, u16 y)
+{
+    TermSize size = g_term_fb_size;
+    if (!_term_canvas_clip(canvas, &src_rect) || x >= size.width ||
+        y >= size.height) {
+        return;
+    }
+
+    u16 width  = KORE_MIN(src_rect.width, (u16)(size.width - x));
+    u16 height = KORE_MIN(src_rect.height, (u16)(size.height - y));
+
+    // Each row is copied a plane at a time.  Rows that are already the same
+    // are left alone, so they stay clean.
+    for (u16 row = 0; row < height; ++row) {
+        usize src = (usize)(src_rect.y + row) * canvas->width + src_rect.x;
+        usize dst = (usize)(y + row) * size.width + x;
+
+#    if TERM_FB_INTERLEAVED
+        bool changed = false;
+        for (u16 i = 0; i < width; ++i) {
+            TermCell  cell = {.ch    = canvas->chars[src + i],
+                              .ink   = canvas->ink[src + i],
+                              .paper = canvas->paper[src + i]};
+            TermCell* fb   = &g_term_fb_cells[dst + i];
+            if (memcmp(fb, &cell, sizeof(cell)) != 0) {
+                *fb     = cell;
+                changed = true;
+            }
+        }
+#    else
+        usize bytes   = width * sizeof(u32);
+        bool  changed = false;
+        if (memcmp(g_term_fb_chars + dst, canvas->chars + src, bytes) != 0) {
+            memcpy(g_term_fb_chars + dst, canvas->chars + src, bytes);
+            changed = true;
+        }
+        if (memcmp(g_term_fb_ink + dst, canvas->ink + src, bytes) != 0) {
+            memcpy(g_term_fb_ink + dst, canvas->ink + src, bytes);
+            changed = true;
+        }
+        if (memcmp(g_term_fb_paper + dst, canvas->paper + src, bytes) != 0) {
+            memcpy(g_term_fb_paper + dst, canvas->paper + src, bytes);
+            changed = true;
+        }
+#    endif // TERM_FB_INTERLEAVED
+
+        if (changed) {
+            _term_fb_mark_dirty(x, y + row, width);
+        }
+    }
+}
+
+// Blends one canvas cell over a framebuffer cell.
+internal void _term_blend_cell(u32* ch,
+                               u32* ink,
+                               u32* paper,
+                               u32  src_ch,
+                               u32  src_ink,
+                               u32  src_paper)
+{
+    if (src_ch == ' ') {
+        *ink = _term_blend_over(*ink, src_paper);
+    } else {
+        *ch  = src_ch;
+        *ink = _term_blend_over(*ink, src_ink);
+    }
+    *paper = _term_blend_over(*paper, src_paper);
+}
+
+void term_fb_blit_blend(const TermCanvas* canvas,
+                        TermRect          src_rect,
+                        u16               x,
+                        u16               y)
+{
+    TermSize size = g_term_fb_size;
+    if (!_term_canvas_clip(canvas, &src_rect) || x >= size.width ||
+        y >= size.height) {
+        return;
+    }
+
+    u16 width  = KORE_MIN(src_rect.width, (u16)(size.width - x));
+    u16 height = KORE_MIN(src_rect.height, (u16)(size.height - y));
+
+    for (u16 row = 0; row < height; ++row) {
+        usize      src       = (usize)(src_rect.y + row) * canvas->width +
+                               src_rect.x;
+        usize      dst       = (usize)(y + row) * size.width + x;
+        const u32* src_ch    = canvas->chars + src;
+        const u32* src_ink   = canvas->ink + src;
+        const u32* src_paper = canvas->paper + src;
+        usize      i         = 0;
+
+#    if TERM_FB_INTERLEAVED
+        TermCell* cells = g_term_fb_cells + dst;
+        for (; i < width; ++i) {
+            _term_blend_cell(&cells[i].ch,
+                             &cells[i].ink,
+                             &cells[i].paper,
+                             src_ch[i],
+                             src_ink[i],
+                             src_paper[i]);
+        }
+#    else
+        u32* ch    = g_term_fb_chars + dst;
+        u32* ink   = g_term_fb_ink + dst;
+        u32* paper = g_term_fb_paper + dst;
+
+        // Spaces select the character and ink below and the canvas paper as
+        // the colour to tint the ink with.
+#        if TERM_SIMD_AVX2
+        __m256i wide_space = _mm256_set1_epi32(' ');
+        for (; i + 8 <= width; i += 8) {
+            __m256i sc    = _mm256_loadu_si256((const __m256i*)(src_ch + i));
+            __m256i si    = _mm256_loadu_si256((const __m256i*)(src_ink + i));
+            __m256i sp    = _mm256_loadu_si256((const __m256i*)(src_paper + i));
+            __m256i blank = _mm256_cmpeq_epi32(sc, wide_space);
+            __m256i c     = _mm256_loadu_si256((const __m256i*)(ch + i));
+            __m256i n     = _mm256_loadu_si256((const __m256i*)(ink + i));
+            __m256i p     = _mm256_loadu_si256((const __m256i*)(paper + i));
+            _mm256_storeu_si256((__m256i*)(ch + i),
+                                _mm256_blendv_epi8(sc, c, blank));
+            _mm256_storeu_si256(
+                (__m256i*)(ink + i),
+                _term_blend_over_avx2(n, _mm256_blendv_epi8(si, sp, blank)));
+            _mm256_storeu_si256((__m256i*)(paper + i),
+                                _term_blend_over_avx2(p, sp));
+        }
+#        endif
+
+#        if TERM_SIMD_SSE2
+        __m128i space = _mm_set1_epi32(' ');
+        for (; i + 4 <= width; i += 4) {
+            __m128i sc    = _mm_loadu_si128((const __m128i*)(src_ch + i));
+            __m128i si    = _mm_loadu_si128((const __m128i*)(src_ink + i));
+            __m128i sp    = _mm_loadu_si128((const __m128i*)(src_paper + i));
+            __m128i blank = _mm_cmpeq_epi32(sc, space);
+            __m128i c     = _mm_loadu_si128((const __m128i*)(ch + i));
+            __m128i n     = _mm_loadu_si128((const __m128i*)(ink + i));
+            __m128i p     = _mm_loadu_si128((const __m128i*)(paper + i));
+            c  = _mm_or_si128(_mm_and_si128(blank, c),
+                              _mm_andnot_si128(blank, sc));
+            si = _mm_or_si128(_mm_and_si128(blank, sp),
+                              _mm_andnot_si128(blank, si));
+            _mm_storeu_si128((__m128i*)(ch + i), c);
+            _mm_storeu_si128((__m128i*)(ink + i), _term_blend_over_sse2(n, si));
+            _mm_storeu_si128((__m128i*)(paper + i),
+                             _term_blend_over_sse2(p, sp));
+        }
+#        endif
+
+        for (; i < width; ++i) {
+            _term_blend_cell(&ch[i],
+                             &ink[i],
+                             &paper[i],
+                             src_ch[i],
+                             src_ink[i],
+                             src_paper[i]);
+        }
+#    endif // TERM_FB_INTERLEAVED
+
+        _term_fb_mark_dirty(x, y + row, width);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Pixel images
+
+#    define TERM_CHAR_UPPER_HALF 0x2580
+#    define TERM_CHAR_BRAILLE 0x2800
+
+// Converts a pixel to a colour in the term_rgb format.
+internal u32 _term_pixel_colour(u32 pixel, TermPixelFormat format)
+{
+    if (format == TERM_PIXELS_RGBA) {
+        // Swap the red and blue bytes.
+        return (pixel & 0xFF00FF00) | ((pixel & 0xFF) << 16) |
+               ((pixel >> 16) & 0xFF);
+    }
+    return pixel;
+}
+
+#    if TERM_SIMD_SSE2
+internal __m128i _term_pixel_colour_4(__m128i pixels, TermPixelFormat format)
+{
+    if (format == TERM_PIXELS_RGBA) {
+        __m128i byte = _mm_set1_epi32(0xFF);
+        __m128i red  = _mm_slli_epi32(_mm_and_si128(pixels, byte), 16);
+        __m128i blue = _mm_and_si128(_mm_srli_epi32(pixels, 16), byte);
+        pixels       = _mm_and_si128(pixels, _mm_set1_epi32((int)0xFF00FF00));
+        pixels       = _mm_or_si128(pixels, _mm_or_si128(red, blue));
+    }
+    return pixels;
+}
+#    endif
+
+// Sets a cell to show a top and a bottom colour.
+internal void
+_term_half_block(u32* ch, u32* ink, u32* paper, u32 top, u32 bottom)
+{
+    *ch    = ((top ^ bottom) & 0xFFFFFF) == 0 ? ' ' : TERM_CHAR_UPPER_HALF;
+    *ink   = top;
+    *paper = bottom;
+}
+
+// Fills a row of cells from a row of top pixels and a row of bottom pixels.
+internal void _term_half_block_row(u32*            chars,
+                                   u32*            ink,
+                                   u32*            paper,
+                                   const u32*      top,
+                                   const u32*      bottom,
+                                   usize           count,
+                                   TermPixelFormat format)
+{
+    usize i = 0;
+
+#    if TERM_SIMD_SSE2
+    // Cells take a space where both pixels match and the half block
+    // elsewhere, chosen with a mask rather than a branch.
+    __m128i rgb   = _mm_set1_epi32(0xFFFFFF);
+    __m128i space = _mm_set1_epi32(' ');
+    __m128i block = _mm_set1_epi32(TERM_CHAR_UPPER_HALF);
+    for (; i + 4 <= count; i += 4) {
+        __m128i t = _mm_loadu_si128((const __m128i*)(top + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(bottom + i));
+        t         = _term_pixel_colour_4(t, format);
+        b         = _term_pixel_colour_4(b, format);
+
+        __m128i same =
+            _mm_cmpeq_epi32(_mm_and_si128(t, rgb), _mm_and_si128(b, rgb));
+        __m128i ch = _mm_or_si128(_mm_and_si128(same, space),
+                                  _mm_andnot_si128(same, block));
+        _mm_storeu_si128((__m128i*)(chars + i), ch);
+        _mm_storeu_si128((__m128i*)(ink + i), t);
+        _mm_storeu_si128((__m128i*)(paper + i), b);
+    }
+#    endif
+
+    for (; i < count; ++i) {
+        _term_half_block(chars + i,
+                         ink + i,
+                         paper + i,
+                         _term_pixel_colour(top[i], format),
+                         _term_pixel_colour(bottom[i], format));
+    }
+}
+
+void term_canvas_half_blocks(TermCanvas* canvas,
+                             u16         x,
+                             u16         y,
+                             TermPixels  image)
+{
+    if (x >= canvas->width || y >= canvas->height) {
+        return;
+    }
+
+    usize stride  = image.stride ? image.stride : image.width;
+    u16   columns = KORE_MIN(image.width, (u16)(canvas->width - x));
+    u16   rows    = KORE_MIN(image.height / 2, canvas->height - y);
+
+    for (u16 row = 0; row < rows; ++row) {
+        usize      index = (usize)(y + row) * canvas->width + x;
+        const u32* top   = image.pixels + (usize)row * 2 * stride;
+        _term_half_block_row(canvas->chars + index,
+                             canvas->ink + index,
+                             canvas->paper + index,
+                             top,
+                             top + stride,
+                             columns,
+                             image.format);
+    }
+
+    // The last pixel row has no partner, so it goes over the paper.
+    if (image.height % 2 != 0 && y + rows < canvas->height) {
+        usize      index = (usize)(y + rows) * canvas->width + x;
+        const u32* top   = image.pixels + (usize)rows * 2 * stride;
+        for (u16 i = 0; i < columns; ++i) {
+            _term_half_block(canvas->chars + index + i,
+                             canvas->ink + index + i,
+                             canvas->paper + index + i,
+                             _term_pixel_colour(top[i], image.format),
+                             canvas->paper[index + i]);
+        }
+    }
+}
+
+// Returns a bit for each of `count` pixels (up to 8) that is not black.
+internal u32 _term_pixels_lit(const u32* pixels, usize count)
+{
+#    if TERM_SIMD_AVX2
+    if (count == 8) {
+        __m256i rgb   = _mm256_set1_epi32(0xFFFFFF);
+        __m256i p     = _mm256_loadu_si256((const __m256i*)pixels);
+        __m256i black = _mm256_cmpeq_epi32(_mm256_and_si256(p, rgb),
+                                           _mm256_setzero_si256());
+        return ~(u32)_mm256_movemask_ps(_mm256_castsi256_ps(black)) & 0xFF;
+    }
+#    elif TERM_SIMD_SSE2
+    if (count == 8) {
+        __m128i rgb  = _mm_set1_epi32(0xFFFFFF);
+        __m128i zero = _mm_setzero_si128();
+        __m128i lo   = _mm_loadu_si128((const __m128i*)pixels);
+        __m128i hi   = _mm_loadu_si128((const __m128i*)(pixels + 4));
+        lo           = _mm_cmpeq_epi32(_mm_and_si128(lo, rgb), zero);
+        hi           = _mm_cmpeq_epi32(_mm_and_si128(hi, rgb), zero);
+        u32 black    = (u32)_mm_movemask_ps(_mm_castsi128_ps(lo)) |
+                    (u32)_mm_movemask_ps(_mm_castsi128_ps(hi)) << 4;
+        return ~black & 0xFF;
+    }
+#    endif
+
+    u32 lit = 0;
+    for (usize i = 0; i < count; ++i) {
+        if ((pixels[i] & 0xFFFFFF) != 0) {
+            lit |= 1u << i;
+        }
+    }
+    return lit;
+}
+
+void term_canvas_braille(
+    TermCanvas* canvas, u16 x, u16 y, TermPixels image, u32 ink, u32 paper)
+{
+    // The dots for a cell's left and right pixels on each of its four rows.
+    static const u8 dots[4][2] = {
+        {0x01, 0x08}, {0x02, 0x10}, {0x04, 0x20}, {0x40, 0x80}};
+
+    if (x >= canvas->width || y >= canvas->height) {
+        return;
+    }
+
+    usize stride  = image.stride ? image.stride : image.width;
+    u16   columns = KORE_MIN((image.width + 1) / 2, canvas->width - x);
+    u16   rows    = KORE_MIN((image.height + 3) / 4, canvas->height - y);
+
+    for (u16 row = 0; row < rows; ++row) {
+        usize index = (usize)(y + row) * canvas->width + x;
+
+        // Four cells are made at a time from eight pixels of each row.
+        for (u16 column = 0; column < columns; column += 4) {
+            u16 cells       = KORE_MIN((u16)4, (u16)(columns - column));
+            u32 patterns[4] = {0};
+
+            for (u16 dy = 0; dy < 4; ++dy) {
+                u16 py = row * 4 + dy;
+                if (py >= image.height) {
+                    break;
+                }
+                usize      px     = (usize)column * 2;
+                usize      count  = KORE_MIN((usize)8, image.width - px);
+                const u32* pixels = image.pixels + py * stride + px;
+                u32        lit    = _term_pixels_lit(pixels, count);
+                for (u16 cell = 0; cell < cells; ++cell) {
+                    u32 pair = (lit >> (cell * 2)) & 3;
+                    patterns[cell] |= (pair & 1 ? dots[dy][0] : 0) |
+                                      (pair & 2 ? dots[dy][1] : 0);
+                }
+            }
+
+            for (u16 cell = 0; cell < cells; ++cell) {
+                usize i          = index + column + cell;
+                u32   pattern    = patterns[cell];
+                canvas->chars[i] = pattern ? TERM_CHAR_BRAILLE + pattern : ' ';
+                canvas->ink[i]   = ink;
+                canvas->paper[i] = paper;
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Output encoding
+//
+// The encoder writes escape sequences and UTF-8 straight into memory taken
+// from the terminal arena.  Space is reserved up front (for a whole row at a
+// time during presentation) so the individual writers never need to check
+// for room.
+
+typedef struct {
+    Arena* arena;
+    u8*    start;  // Start of the encoded output
+    u8*    cursor; // Next byte to write
+    u8*    end;    // End of the reserved space
+
+    // Terminal state once the output so far has been processed.  A cursor x
+    // equal to the framebuffer width means the cursor is waiting to wrap.
+    i32  x; // Cursor position, or -1 if unknown
+    i32  y;
+    u32  ink;   // Colour keys (see _term_colour_key) of the current colours
+    u32  paper;
+    bool colours_known;
+
+    TermColourMode colour_mode;
+} TermEncoder;
+
+// Maximum bytes a single cell can cost: a cursor move, two colour changes and
+// a 4 byte UTF-8 sequence.
+#    define TERM_ENC_MAX_CELL_BYTES 64
+
+typedef struct {
+    u8   length;
+    char digits[3];
+} TermDecimal;
+
+#    define TERM_DEC(n) {sizeof(#n) - 1, #n}
+#    define TERM_DEC_10(n)                                                     \
+        TERM_DEC(n##0), TERM_DEC(n##1), TERM_DEC(n##2), TERM_DEC(n##3),        \
+            TERM_DEC(n##4), TERM_DEC(n##5), TERM_DEC(n##6), TERM_DEC(n##7),    \
+            TERM_DEC(n##8), TERM_DEC(n##9)
+
+// Pre-encoded decimal strings for every colour channel value.
+global_variable const TermDecimal g_term_decimals[256] = {
+    TERM_DEC(0),    TERM_DEC(1),    TERM_DEC(2),    TERM_DEC(3),
+    TERM_DEC(4),    TERM_DEC(5),    TERM_DEC(6),    TERM_DEC(7),
+    TERM_DEC(8),    TERM_DEC(9),    TERM_DEC_10(1), TERM_DEC_10(2),
+    TERM_DEC_10(3), TERM_DEC_10(4), TERM_DEC_10(5), TERM_DEC_10(6),
+    TERM_DEC_10(7), TERM_DEC_10(8), TERM_DEC_10(9), TERM_DEC_10(10),
+    TERM_DEC_10(11), TERM_DEC_10(12), TERM_DEC_10(13), TERM_DEC_10(14),
+    TERM_DEC_10(15), TERM_DEC_10(16), TERM_DEC_10(17), TERM_DEC_10(18),
+    TERM_DEC_10(19), TERM_DEC_10(20), TERM_DEC_10(21), TERM_DEC_10(22),
+    TERM_DEC_10(23), TERM_DEC_10(24), TERM_DEC(250), TERM_DEC(251),
+    TERM_DEC(252), TERM_DEC(253), TERM_DEC(254), TERM_DEC(255),
+};
+
+#    undef TERM_DEC_10
+#    undef TERM_DEC
+
+internal void _term_enc_begin(TermEncoder* enc, Arena* arena)
+{
+    enc->arena  = arena;
+    enc->start  = (u8*)arena_store(arena);
+    enc->cursor        = enc->start;
+    enc->end           = enc->start;
+    enc->x             = -1;
+    enc->y             = -1;
+    enc->ink           = 0;
+    enc->paper         = 0;
+    enc->colours_known = false;
+    enc->colour_mode   = g_term.colour_mode;
+}
+
+// Makes sure there is room for at least `bytes` more bytes of output.  The
+// arena must not be used for anything else while encoding so that the
+// reserved space stays contiguous.
+internal void _term_enc_reserve(TermEncoder* enc, usize bytes)
+{
+    usize available = (usize)(enc->end - enc->cursor);
+    if (available < bytes) {
+        usize grow = KORE_MAX(bytes - available, KORE_KB(16));
+        arena_alloc(enc->arena, grow);
+        enc->end += grow;
+    }
+}
+
+// Finishes encoding, handing any unused reserved space back to the arena.
+// Returns the number of bytes encoded.
+internal usize _term_enc_end(TermEncoder* enc)
+{
+    arena_restore(enc->arena, enc->cursor);
+    enc->end = enc->cursor;
+    return (usize)(enc->cursor - enc->start);
+}
+
+internal void _term_enc_byte(TermEncoder* enc, u8 byte)
+{
+    *enc->cursor++ = byte;
+}
+
+internal void _term_enc_bytes(TermEncoder* enc, const void* bytes, usize count)
+{
+    memcpy(enc->cursor, bytes, count);
+    enc->cursor += count;
+}
+
+#    define _term_enc_literal(enc, str)                                        \
+        _term_enc_bytes((enc), (str), sizeof(str) - 1)
+
+internal void _term_enc_uint(TermEncoder* enc, u32 value)
+{
+    if (value < 256) {
+        // Always copy all the digits and then only advance by the length.
+        const TermDecimal* dec = &g_term_decimals[value];
+        memcpy(enc->cursor, dec->digits, sizeof(dec->digits));
+        enc->cursor += dec->length;
+        return;
+    }
+
+    char  digits[10];
+    usize count = 0;
+    do {
+        digits[count++] = (char)('0' + (value % 10));
+        value /= 10;
+    } while (value != 0);
+
+    while (count > 0) {
+        *enc->cursor++ = (u8)digits[--count];
+    }
+}
+
+internal void _term_enc_utf8(TermEncoder* enc, u32 ch)
+{
+    u8* p = enc->cursor;
+    if (ch <= 0x7F) {
+        p[0] = (u8)ch;
+        enc->cursor += 1;
+    } else if (ch <= 0x7FF) {
+        p[0] = (u8)(0xC0 | ((ch >> 6) & 0x1F));
+        p[1] = (u8)(0x80 | (ch & 0x3F));
+        enc->cursor += 2;
+    } else if (ch <= 0xFFFF) {
+        p[0] = (u8)(0xE0 | ((ch >> 12) & 0x0F));
+        p[1] = (u8)(0x80 | ((ch >> 6) & 0x3F));
+        p[2] = (u8)(0x80 | (ch & 0x3F));
+        enc->cursor += 3;
+    } else {
+        p[0] = (u8)(0xF0 | ((ch >> 18) & 0x07));
+        p[1] = (u8)(0x80 | ((ch >> 12) & 0x3F));
+        p[2] = (u8)(0x80 | ((ch >> 6) & 0x3F));
+        p[3] = (u8)(0x80 | (ch & 0x3F));
+        enc->cursor += 4;
+    }
+}
+
+// Moves the cursor to an absolute position (CUP).  Coordinates are 0-based.
+internal void _term_enc_goto(TermEncoder* enc, u16 x, u16 y)
+{
+    _term_enc_literal(enc, "\x1b[");
+    _term_enc_uint(enc, (u32)y + 1);
+    _term_enc_byte(enc, ';');
+    _term_enc_uint(enc, (u32)x + 1);
+    _term_enc_byte(enc, 'H');
+}
+
+internal usize _term_enc_uint_length(u32 value)
+{
+    return value < 10      ? 1
+           : value < 100   ? 2
+           : value < 1000  ? 3
+           : value < 10000 ? 4
+                           : 5;
+}
+
+internal usize _term_enc_utf8_length(u32 ch)
+{
+    return ch <= 0x7F ? 1 : ch <= 0x7FF ? 2 : ch <= 0xFFFF ? 3 : 4;
+}
+
+internal void _term_enc_rgb(TermEncoder* enc, u32 colour)
+{
+    _term_enc_uint(enc, (colour >> 16) & 0xFF);
+    _term_enc_byte(enc, ';');
+    _term_enc_uint(enc, (colour >> 8) & 0xFF);
+    _term_enc_byte(enc, ';');
+    _term_enc_uint(enc, colour & 0xFF);
+}
+
+// Writes the SGR parameters for an ink or paper colour key.
+internal void _term_enc_colour_params(TermEncoder* enc, u32 key, bool paper)
+{
+    switch (enc->colour_mode) {
+    case TERM_COLOUR_TRUE:
+        _term_enc_byte(enc, paper ? '4' : '3');
+        _term_enc_literal(enc, "8;2;");
+        _term_enc_rgb(enc, key);
+        break;
+
+    case TERM_COLOUR_256:
+        _term_enc_byte(enc, paper ? '4' : '3');
+        _term_enc_literal(enc, "8;5;");
+        _term_enc_uint(enc, key);
+        break;
+
+    case TERM_COLOUR_16:
+        // 30-37/40-47 for the normal colours, 90-97/100-107 for bright.
+        _term_enc_uint(enc,
+                       (key < 8 ? 30 + key : 90 + key - 8) + (paper ? 10 : 0));
+        break;
+    }
+}
+
+// Sets the ink and paper colours, only sending the ones that differ from the
+// terminal's current state.  Both are combined into a single SGR sequence
+// when they both change.
+internal void _term_enc_colours(TermEncoder* enc, u32 ink, u32 paper)
+{
+    u32  ink_key       = _term_colour_key(ink, enc->colour_mode);
+    u32  paper_key     = _term_colour_key(paper, enc->colour_mode);
+    bool ink_changed   = !enc->colours_known || enc->ink != ink_key;
+    bool paper_changed = !enc->colours_known || enc->paper != paper_key;
+
+    if (ink_changed || paper_changed) {
+        _term_enc_literal(enc, "\x1b[");
+        if (ink_changed) {
+            _term_enc_colour_params(enc, ink_key, false);
+        }
+        if (ink_changed && paper_changed) {
+            _term_enc_byte(enc, ';');
+        }
+        if (paper_changed) {
+            _term_enc_colour_params(enc, paper_key, true);
+        }
+        _term_enc_byte(enc, 'm');
+    }
+
+    enc->ink           = ink_key;
+    enc->paper         = paper_key;
+    enc->colours_known = true;
+}
+
+//------------------------------------------------------------------------------
+// Presentation
+
+// Works out how the cell at the given index appears on the terminal.  Returns
+// the number of cells it covers (a wide character and its tail are handled as
+// a single unit) and writes the code point that should be transmitted.
+internal u16 _term_fb_cell_glyph(usize index, u16 x, u16 width, u32* out_ch)
+{
+    u32 ch = TERM_FB_CH(index);
+
+    if (ch == TERM_FB_CHAR_WIDE_TAIL) {
+        // An orphaned tail whose wide character has been overwritten.
+        *out_ch = ' ';
+        return 1;
+    }
+
+    if (ch < 0x20 || (ch >= 0x7F && ch < 0xA0)) {
+        // Never send control characters as they would move the cursor.
+        *out_ch = ' ';
+        return 1;
+    }
+
+    if (ch >= 0x300) {
+        int char_width = term_char_width(ch);
+        if (char_width == 2) {
+            if (x + 1 < width &&
+                TERM_FB_CH(index + 1) == TERM_FB_CHAR_WIDE_TAIL) {
+                *out_ch = ch;
+                return 2;
+            }
+            // No room for the wide character, so it cannot be shown.
+            *out_ch = ' ';
+            return 1;
+        }
+        if (char_width <= 0) {
+            // Zero-width characters would not advance the cursor.
+            *out_ch = ' ';
+            return 1;
+        }
+    }
+
+    *out_ch = ch;
+    return 1;
+}
+
+// Finds the next dirty cell of a row in [from, end), returning end if there
+// are none.
+internal u16 _term_fb_next_dirty(const u64* row, u16 from, u16 end)
+{
+    if (from >= end) {
+        return end;
+    }
+
+    usize word = from >> 6;
+    u64   bits = row[word] & (~0ull << (from & 63));
+    while (bits == 0) {
+        if (++word << 6 >= end) {
+            return end;
+        }
+        bits = row[word];
+    }
+
+    usize x = (word << 6) + bits_ctz_u64(bits);
+    return (u16)KORE_MIN(x, (usize)end);
+}
+
+internal bool _term_fb_cells_changed(usize index, u16 cells)
+{
+#    if TERM_FB_INTERLEAVED
+    // The reserved flags are always 0 so whole cells compare equal exactly
+    // when their characters and colours do.
+    return memcmp(g_term_fb_cells + index,
+                  g_term_fb_front_cells + index,
+                  cells * sizeof(TermCell)) != 0;
+#    else
+    for (u16 i = 0; i < cells; ++i) {
+        usize cell = index + i;
+        if (g_term_fb_chars[cell] != g_term_fb_front_chars[cell] ||
+            g_term_fb_ink[cell] != g_term_fb_front_ink[cell] ||
+            g_term_fb_paper[cell] != g_term_fb_front_paper[cell]) {
+            return true;
+        }
+    }
+    return false;
+#    endif
+}
+
+internal void _term_fb_cells_sent(usize index, u16 cells)
+{
+#    if TERM_FB_INTERLEAVED
+    memcpy(g_term_fb_front_cells + index,
+           g_term_fb_cells + index,
+           cells * sizeof(TermCell));
+#    else
+    for (u16 i = 0; i < cells; ++i) {
+        usize cell                  = index + i;
+        g_term_fb_front_chars[cell] = g_term_fb_chars[cell];
+        g_term_fb_front_ink[cell]   = g_term_fb_ink[cell];
+        g_term_fb_front_paper[cell] = g_term_fb_paper[cell];
+    }
+#    endif
+}
+
+// Counts the changed cells from x up to end that show the same character in
+// the same colours as the single cell at `index`, just before x.  These can
+// be sent by repeating that cell with REP.
+internal u16 _term_fb_run_length(usize index, u16 x, u16 end, u16 width, u32 ch)
+{
+    usize row_index = index - (x - 1);
+    u32   ink       = TERM_FB_INK(index);
+    u32   paper     = TERM_FB_PAPER(index);
+    u16   count     = 0;
+
+    for (; x < end; ++x, ++count) {
+        usize next = row_index + x;
+        u32   next_ch;
+        if (TERM_FB_INK(next) != ink || TERM_FB_PAPER(next) != paper ||
+            _term_fb_cell_glyph(next, x, width, &next_ch) != 1 ||
+            next_ch != ch || !_term_fb_cells_changed(next, 1)) {
+            break;
+        }
+    }
+
+    return count;
+}
+
+// The most unchanged cells that will be printed again to move the cursor.
+#    define TERM_ENC_MAX_REPRINT 8
+
+// Ways of moving the cursor along a row.
+typedef enum {
+    TERM_MOVE_NONE,
+    TERM_MOVE_FORWARD, // CUF along the row
+    TERM_MOVE_BACK,    // CUB along the row
+    TERM_MOVE_REPRINT, // Print the unchanged cells again
+} TermMoveKind;
+
+typedef struct {
+    TermMoveKind kind;
+    usize        cost;
+} TermMove;
+
+internal usize _term_enc_goto_cost(u16 x, u16 y)
+{
+    if (x == 0) {
+        return y == 0 ? 3 : 3 + _term_enc_uint_length((u32)y + 1);
+    }
+    return 4 + _term_enc_uint_length((u32)y + 1) +
+           _term_enc_uint_length((u32)x + 1);
+}
+
+internal usize _term_enc_step_cost(u16 count)
+{
+    return count == 1 ? 3 : 3 + _term_enc_uint_length(count);
+}
+
+// Cost in bytes of printing the already transmitted cells [from, to) of a row
+// again, or SIZE_MAX if that is not possible with the current colours.  It is
+// not possible from the tail of a wide character either, as printing there
+// erases the character; the cursor can land there after moving down a column.
+internal usize _term_enc_reprint_cost(TermEncoder* enc,
+                                      usize        row_index,
+                                      u16          from,
+                                      u16          to,
+                                      u16          width)
+{
+    if (!enc->colours_known || to - from > TERM_ENC_MAX_REPRINT ||
+        TERM_FB_CH(row_index + from) == TERM_FB_CHAR_WIDE_TAIL) {
+        return SIZE_MAX;
+    }
+
+    usize cost = 0;
+    u16   x    = from;
+    while (x < to) {
+        usize index = row_index + x;
+        if (_term_colour_key(TERM_FB_INK(index), enc->colour_mode) !=
+                enc->ink ||
+            _term_colour_key(TERM_FB_PAPER(index), enc->colour_mode) !=
+                enc->paper) {
+            return SIZE_MAX;
+        }
+        u32 ch;
+        x += _term_fb_cell_glyph(index, x, width, &ch);
+        cost += _term_enc_utf8_length(ch);
+    }
+
+    return x == to ? cost : SIZE_MAX;
+}
+
+// Finds the cheapest way to move forward along a row from one column to
+// another.
+internal TermMove _term_enc_forward_move(TermEncoder* enc,
+                                         usize        row_index,
+                                         u16          from,
+                                         u16          to,
+                                         u16          width)
+{
+    if (from == to) {
+        return (TermMove){TERM_MOVE_NONE, 0};
+    }
+
+    TermMove move    = {TERM_MOVE_FORWARD, _term_enc_step_cost(to - from)};
+    usize    reprint = _term_enc_reprint_cost(enc, row_index, from, to, width);
+    if (reprint < move.cost) {
+        move = (TermMove){TERM_MOVE_REPRINT, reprint};
+    }
+    return move;
+}
+
+internal void _term_enc_apply_move(TermEncoder* enc,
+                                   TermMove     move,
+                                   usize        row_index,
+                                   u16          from,
+                                   u16          to,
+                                   u16          width)
+{
+    switch (move.kind) {
+    case TERM_MOVE_NONE: break;
+
+    case TERM_MOVE_FORWARD:
+    case TERM_MOVE_BACK:
+        {
+            u16 count = move.kind == TERM_MOVE_FORWARD ? to - from : from - to;
+            _term_enc_literal(enc, "\x1b[");
+            if (count != 1) {
+                _term_enc_uint(enc, count);
+            }
+            _term_enc_byte(enc, move.kind == TERM_MOVE_FORWARD ? 'C' : 'D');
+        }
+        break;
+
+    case TERM_MOVE_REPRINT:
+        for (u16 x = from; x < to;) {
+            u32 ch;
+            x += _term_fb_cell_glyph(row_index + x, x, width, &ch);
+            _term_enc_utf8(enc, ch);
+        }
+        break;
+    }
+}
+
+// Moves the cursor to a cell using whichever of CUP, CUF, CUB, CR/LF, CUD or
+// reprinting unchanged cells costs the fewest bytes.
+internal void _term_enc_move(TermEncoder* enc, u16 x, u16 y, u16 width)
+{
+    if (enc->x == x && enc->y == y) {
+        return;
+    }
+
+    usize row_index = (usize)y * width;
+
+    // Absolute positioning always works.
+    usize best_cost = _term_enc_goto_cost(x, y);
+    enum {
+        TERM_ROUTE_GOTO,
+        TERM_ROUTE_ROW,  // Move along the current row
+        TERM_ROUTE_CR,   // Carriage return, then move along the row
+        TERM_ROUTE_CRLF, // Carriage returns and line feeds, then along the row
+        TERM_ROUTE_DOWN, // Move down the column, then along the row
+    } route = TERM_ROUTE_GOTO;
+    TermMove  row_move = {0}, cr_move = {0}, down_move = {0};
+    u16       dy       = 0;
+    bool      pending  = enc->x == (i32)width;
+
+    if (enc->y == y && enc->x >= 0) {
+        // Relative moves are not reliable while waiting to wrap.
+        if (!pending) {
+            if (x > enc->x) {
+                row_move = _term_enc_forward_move(
+                    enc, row_index, (u16)enc->x, x, width);
+            } else {
+                row_move = (TermMove){TERM_MOVE_BACK,
+                                      _term_enc_step_cost((u16)(enc->x - x))};
+            }
+            if (row_move.cost < best_cost) {
+                best_cost = row_move.cost;
+                route     = TERM_ROUTE_ROW;
+            }
+        }
+
+        cr_move = _term_enc_forward_move(enc, row_index, 0, x, width);
+        if (1 + cr_move.cost < best_cost) {
+            best_cost = 1 + cr_move.cost;
+            route     = TERM_ROUTE_CR;
+        }
+    } else if (enc->y >= 0 && y > enc->y && enc->x >= 0) {
+        dy      = (u16)(y - enc->y);
+
+        // CR LF works from the pending wrap state too.
+        cr_move = _term_enc_forward_move(enc, row_index, 0, x, width);
+        if (dy <= 4 && 2 * (usize)dy + cr_move.cost < best_cost) {
+            best_cost = 2 * (usize)dy + cr_move.cost;
+            route     = TERM_ROUTE_CRLF;
+        }
+
+        if (!pending && x >= enc->x) {
+            down_move = _term_enc_forward_move(
+                enc, row_index, (u16)enc->x, x, width);
+            usize cost = _term_enc_step_cost(dy) + down_move.cost;
+            if (cost < best_cost) {
+                best_cost = cost;
+                route     = TERM_ROUTE_DOWN;
+            }
+        }
+    }
+
+    switch (route) {
+    case TERM_ROUTE_GOTO: _term_enc_goto(enc, x, y); break;
+
+    case TERM_ROUTE_ROW:
+        _term_enc_apply_move(enc, row_move, row_index, (u16)enc->x, x, width);
+        break;
+
+    case TERM_ROUTE_CR:
+        _term_enc_byte(enc, '\r');
+        _term_enc_apply_move(enc, cr_move, row_index, 0, x, width);
+        break;
+
+    case TERM_ROUTE_CRLF:
+        for (u16 i = 0; i < dy; ++i) {
+            _term_enc_literal(enc, "\r\n");
+        }
+        _term_enc_apply_move(enc, cr_move, row_index, 0, x, width);
+        break;
+
+    case TERM_ROUTE_DOWN:
+        _term_enc_literal(enc, "\x1b[");
+        if (dy != 1) {
+            _term_enc_uint(enc, dy);
+        }
+        _term_enc_byte(enc, 'B');
+        _term_enc_apply_move(
+            enc, down_move, row_index, (u16)enc->x, x, width);
+        break;
+    }
+
+    enc->x = x;
+    enc->y = y;
+}
+
+// Encodes the dirty cells of a row that differ from the front buffer, and
+// clears them.  Returns the number of dirty cells.
+internal usize _term_fb_encode_row(TermEncoder* enc, u16 y)
+{
+    TermSize size       = g_term_fb_size;
+    usize    base_index = (usize)y * size.width;
+    u64*     dirty = g_term_fb_dirty + (usize)y * g_term_fb_dirty_words;
+    u16      x     = g_term_fb_dirty_x0[y];
+    u16      end   = g_term_fb_dirty_x1[y];
+    u16      done  = 0; // Cells before this have been dealt with
+    usize    dirty_cells = 0;
+
+    for (usize i = x >> 6; i <= (usize)(end - 1) >> 6; ++i) {
+        dirty_cells += bits_popcount_u64(dirty[i]);
+    }
+
+    _term_enc_reserve(enc, (usize)(end - x + 1) * TERM_ENC_MAX_CELL_BYTES);
+
+    while ((x = _term_fb_next_dirty(dirty, x, end)) < end) {
+        // A dirty tail is sent along with its wide character.
+        if (x > done && TERM_FB_CH(base_index + x) == TERM_FB_CHAR_WIDE_TAIL) {
+            u32 head_ch;
+            if (_term_fb_cell_glyph(
+                    base_index + x - 1, x - 1, size.width, &head_ch) == 2) {
+                x--;
+            }
+        }
+
+        usize index = base_index + x;
+        u32   ch;
+        u16   cells = _term_fb_cell_glyph(index, x, size.width, &ch);
+
+        if (_term_fb_cells_changed(index, cells)) {
+            _term_enc_move(enc, x, y, size.width);
+            _term_enc_colours(enc, TERM_FB_INK(index), TERM_FB_PAPER(index));
+            _term_enc_utf8(enc, ch);
+            _term_fb_cells_sent(index, cells);
+
+            // Repeat the character over a run of the same cells if that is
+            // shorter than sending them.
+            u16 repeats = 0;
+            if (g_term.rep && cells == 1) {
+                repeats =
+                    _term_fb_run_length(index, x + 1, end, size.width, ch);
+            }
+            if (repeats > 0 && _term_enc_step_cost(repeats) <
+                                   repeats * _term_enc_utf8_length(ch)) {
+                _term_enc_literal(enc, "\x1b[");
+                if (repeats != 1) {
+                    _term_enc_uint(enc, repeats);
+                }
+                _term_enc_byte(enc, 'b');
+                _term_fb_cells_sent(index + 1, repeats);
+                cells += repeats;
+            }
+
+            // Writing the last column leaves the cursor waiting to wrap.
+            enc->x  = KORE_MIN(x + cells, size.width);
+
+            // Overwriting the start of a wide character also blanks the rest
+            // of it, so that cell has to be sent again.
+            u16 after = x + cells;
+            if (after < size.width &&
+                TERM_FB_FRONT_CH(base_index + after) ==
+                    TERM_FB_CHAR_WIDE_TAIL) {
+                TERM_FB_FRONT_CH(base_index + after) = TERM_FB_CHAR_INVALID;
+                dirty[after >> 6] |= 1ull << (after & 63);
+                if (after >= end) {
+                    end                   = after + 1;
+                    g_term_fb_dirty_x1[y] = end;
+                }
+            }
+        }
+
+        x += cells;
+        done = x;
+    }
+
+    _term_fb_clear_dirty_cells(y);
+    return dirty_cells;
+}
+
+// Encodes the dirty rows in [y0, y1).  Returns the number of dirty cells.
+internal usize _term_fb_encode_rows(TermEncoder* enc, u16 y0, u16 y1)
+{
+    usize dirty_cells = 0;
+    if (y0 >= y1) {
+        return 0;
+    }
+
+    usize last_word = (usize)(y1 - 1) >> 6;
+    for (usize word = y0 >> 6; word <= last_word; ++word) {
+        u64 rows = g_term_fb_dirty_rows[word];
+        if (word == (usize)y0 >> 6) {
+            rows &= ~0ull << (y0 & 63);
+        }
+        if (word == last_word) {
+            rows &= ~0ull >> (63 - ((y1 - 1) & 63));
+        }
+        while (rows != 0) {
+            u16 y = (u16)((word << 6) + bits_ctz_u64(rows));
+            rows &= rows - 1;
+            dirty_cells += _term_fb_encode_row(enc, y);
+        }
+    }
+
+    return dirty_cells;
+}
+
+// Encodes the whole screen from the back buffer, for a terminal in an unknown
+// state.  Straight after a present this is what the terminal shows.
+internal string _term_fb_encode_screen(void)
+{
+    TermSize    size = g_term_fb_size;
+    TermEncoder enc;
+
+    arena_reset(&g_term_screen_arena);
+    _term_enc_begin(&enc, &g_term_screen_arena);
+    _term_enc_reserve(&enc, TERM_ENC_MAX_CELL_BYTES);
+    _term_enc_literal(&enc, "\x1b[?2026h\x1b[?25l\x1b[0m\x1b[2J");
+
+    for (u16 y = 0; y < size.height; ++y) {
+        usize row = (usize)y * size.width;
+        _term_enc_reserve(&enc,
+                          ((usize)size.width + 1) * TERM_ENC_MAX_CELL_BYTES);
+        _term_enc_goto(&enc, 0, y);
+        for (u16 x = 0; x < size.width;) {
+            u32 ch;
+            u16 cells = _term_fb_cell_glyph(row + x, x, size.width, &ch);
+            _term_enc_colours(
+                &enc, TERM_FB_INK(row + x), TERM_FB_PAPER(row + x));
+            _term_enc_utf8(&enc, ch);
+            x += cells;
+        }
+    }
+
+    _term_enc_reserve(&enc, TERM_ENC_MAX_CELL_BYTES);
+    if (g_cursor_visible) {
+        _term_enc_literal(&enc, "\x1b[?25h");
+    }
+    _term_enc_literal(&enc, "\x1b[?2026l");
+    return string_from(enc.start, _term_enc_end(&enc));
+}
+
+//------------------------------------------------------------------------------
+// Parallel encoding
+//
+// Large frames are split into bands of rows that are encoded at the same time
+// on a thread pool.  Each band has its own arena and encoder.  The encoder
+// starts knowing nothing about the cursor or colours, so a band's output
+// begins with an absolute move and a full colour change and does not depend
+// on the bands before it.  The bands are then written with one writev().
+
+// Dirty cells a frame needs before it is worth encoding in parallel.
+#    ifndef TERM_PRESENT_PARALLEL_CELLS
+#        define TERM_PRESENT_PARALLEL_CELLS 32768
+#    endif
+
+#    define TERM_PRESENT_MAX_THREADS 8
+
+typedef struct {
+    Arena       arena;
+    TermEncoder enc;
+    u16         y0; // Rows [y0, y1) of the framebuffer
+    u16         y1;
+    usize       dirty_cells;
+    usize       bytes;
+} TermBand;
+
+global_variable ThreadPool g_term_present_pool;
+global_variable TermBand   g_term_bands[TERM_PRESENT_MAX_THREADS];
+global_variable usize      g_term_band_count = 0; // 0 until the pool starts
+
+// Starts the thread pool and band arenas the first time they are needed.
+// Returns the number of bands available.
+internal usize _term_present_bands(void)
+{
+    if (g_term_band_count == 0) {
+        usize threads = g_term.present_threads;
+        if (threads == 0) {
+            threads = KORE_MIN(cpu_count(), (usize)TERM_PRESENT_MAX_THREADS);
+        }
+        threads = KORE_MIN(threads, (usize)TERM_PRESENT_MAX_THREADS);
+        if (threads <= 1) {
+            return 1;
+        }
+
+        // The calling thread encodes a band too.
+        thread_pool_init(&g_term_present_pool, threads - 1);
+        g_term_band_count = g_term_present_pool.thread_count + 1;
+        for (usize i = 0; i < g_term_band_count; ++i) {
+            arena_init(&g_term_bands[i].arena,
+                       .reserved_size = KORE_MB(128),
+                       .grow_rate     = 1);
+        }
+    }
+    return g_term_band_count;
+}
+
+internal void _term_present_done(void)
+{
+    if (g_term_band_count > 0) {
+        thread_pool_done(&g_term_present_pool);
+        for (usize i = 0; i < g_term_band_count; ++i) {
+            arena_done(&g_term_bands[i].arena);
+        }
+        g_term_band_count = 0;
+    }
+}
+
+// Splits the dirty rows into bands with about the same number of dirty rows
+// in each.  Returns the number of bands, or 1 if the frame is too small to be
+// worth splitting.
+internal usize _term_fb_split_bands(void)
+{
+    TermSize size       = g_term_fb_size;
+    usize    row_words  = ((usize)size.height + 63) / 64;
+    usize    dirty_rows = 0;
+    usize    span_cells = 0;
+
+    for (usize word = 0; word < row_words; ++word) {
+        u64 rows = g_term_fb_dirty_rows[word];
+        dirty_rows += bits_popcount_u64(rows);
+        while (rows != 0) {
+            u16 y = (u16)((word << 6) + bits_ctz_u64(rows));
+            rows &= rows - 1;
+            span_cells += g_term_fb_dirty_x1[y] - g_term_fb_dirty_x0[y];
+        }
+    }
+
+    if (span_cells < TERM_PRESENT_PARALLEL_CELLS || dirty_rows < 2) {
+        return 1;
+    }
+
+    usize bands         = KORE_MIN(_term_present_bands(), dirty_rows);
+    usize rows_per_band = (dirty_rows + bands - 1) / bands;
+    usize band          = 0;
+    usize count         = 0;
+
+    g_term_bands[0].y0 = 0;
+    for (u16 y = 0; y < size.height && band + 1 < bands; ++y) {
+        if (g_term_fb_dirty_rows[y >> 6] & (1ull << (y & 63))) {
+            if (++count == rows_per_band) {
+                g_term_bands[band].y1   = y + 1;
+                g_term_bands[++band].y0 = y + 1;
+                count                   = 0;
+            }
+        }
+    }
+    g_term_bands[band].y1 = size.height;
+
+    return band + 1;
+}
+
+internal void _term_fb_encode_band(void* data, usize index)
+{
+    TermBand* band = (TermBand*)data + index;
+    arena_reset(&band->arena);
+    _term_enc_begin(&band->enc, &band->arena);
+    band->dirty_cells = _term_fb_encode_rows(&band->enc, band->y0, band->y1);
+    band->bytes       = _term_enc_end(&band->enc);
+}
+
+//------------------------------------------------------------------------------
+// Background writer
+//
+// With threaded output, each frame is encoded into one of two arenas and
+// handed to a writer thread, so the caller can draw the next frame while this
+// one drains to the terminal.  The next frame goes into the other arena.  If
+// that one still holds a frame waiting to be written, the terminal is not
+// keeping up and the new frame is dropped before it is encoded: the dirty
+// cells and scrolls are left as they are and go out with a later frame.
+
+typedef struct {
+    Thread  thread;
+    Mutex   mutex;
+    CondVar wake; // Signalled when a frame is queued or the writer must stop
+    CondVar idle; // Signalled when a frame has been written
+    Arena   arenas[2];
+    string  frames[2];
+    i32     queued;  // Arena of the frame waiting to be written, or -1
+    i32     writing; // Arena of the frame being written, or -1
+    bool    quit;
+    bool    running;
+} TermWriter;
+
+global_variable TermWriter g_term_writer;
+
+internal void _term_writer_main(void* data)
+{
+    TermWriter* writer = (TermWriter*)data;
+
+    mutex_lock(&writer->mutex);
+    for (;;) {
+        if (writer->queued >= 0) {
+            writer->writing = writer->queued;
+            writer->queued  = -1;
+            string frame    = writer->frames[writer->writing];
+            mutex_unlock(&writer->mutex);
+
+            _term_output(frame.data, frame.count);
+
+            mutex_lock(&writer->mutex);
+            writer->writing = -1;
+            cond_broadcast(&writer->idle);
+        } else if (writer->quit) {
+            break;
+        } else {
+            cond_wait(&writer->wake, &writer->mutex);
+        }
+    }
+    mutex_unlock(&writer->mutex);
+}
+
+internal void _term_writer_start(void)
+{
+    TermWriter* writer = &g_term_writer;
+    if (writer->running) {
+        return;
+    }
+
+    *writer = (TermWriter){.queued = -1, .writing = -1};
+    mutex_init(&writer->mutex);
+    cond_init(&writer->wake);
+    cond_init(&writer->idle);
+    for (usize i = 0; i < 2; ++i) {
+        arena_init(
+            &writer->arenas[i], .reserved_size = KORE_MB(128), .grow_rate = 1);
+    }
+
+    writer->running = thread_start(&writer->thread, _term_writer_main, writer);
+    if (!writer->running) {
+        // Without a thread, frames are written directly.
+        for (usize i = 0; i < 2; ++i) {
+            arena_done(&writer->arenas[i]);
+        }
+        cond_done(&writer->idle);
+        cond_done(&writer->wake);
+        mutex_done(&writer->mutex);
+    }
+}
+
+// Writes any queued frame and stops the writer thread.
+internal void _term_writer_stop(void)
+{
+    TermWriter* writer = &g_term_writer;
+    if (!writer->running) {
+        return;
+    }
+
+    mutex_lock(&writer->mutex);
+    writer->quit = true;
+    cond_signal(&writer->wake);
+    mutex_unlock(&writer->mutex);
+    thread_join(&writer->thread);
+
+    for (usize i = 0; i < 2; ++i) {
+        arena_done(&writer->arenas[i]);
+    }
+    cond_done(&writer->idle);
+    cond_done(&writer->wake);
+    mutex_done(&writer->mutex);
+    writer->running = false;
+}
+
+// Waits until every queued frame has been written, so that output sent
+// directly afterwards is not mixed up with a frame.
+internal void _term_writer_wait(void)
+{
+    TermWriter* writer = &g_term_writer;
+    if (!writer->running) {
+        return;
+    }
+
+    mutex_lock(&writer->mutex);
+    while (writer->queued >= 0 || writer->writing >= 0) {
+        cond_wait(&writer->idle, &writer->mutex);
+    }
+    mutex_unlock(&writer->mutex);
+}
+
+// Returns the arena to encode the next frame into, or NULL if a frame is
+// already waiting and this one must be dropped.
+internal Arena* _term_writer_acquire(void)
+{
+    TermWriter* writer = &g_term_writer;
+    Arena*      arena  = NULL;
+
+    mutex_lock(&writer->mutex);
+    if (writer->queued < 0) {
+        arena = &writer->arenas[writer->writing == 0 ? 1 : 0];
+    }
+    mutex_unlock(&writer->mutex);
+
+    return arena;
+}
+
+// Queues a frame encoded into an arena from _term_writer_acquire.
+internal void _term_writer_queue(Arena* arena, string frame)
+{
+    TermWriter* writer = &g_term_writer;
+    i32         index  = (i32)(arena - writer->arenas);
+
+    mutex_lock(&writer->mutex);
+    writer->frames[index] = frame;
+    writer->queued        = index;
+    cond_signal(&writer->wake);
+    mutex_unlock(&writer->mutex);
+}
+
+//------------------------------------------------------------------------------
+// Broadcasting
+//
+// Each frame is copied once into a reference counted buffer that every client
+// queues.  Only the presenting thread touches the buffers, so the counts need
+// no locking.  Clients are written to with non-blocking sendmsg(), several
+// queued frames at a time, and whatever does not fit waits for the next
+// present.  A client whose queue is full has its waiting frames dropped
+// (except one already part written) and is sent the whole screen instead.
+//
+// Every frame starts with an absolute cursor move and a full colour change,
+// so a client can pick up the stream after any of them.  Whole screens are
+// encoded from the back buffer, which matches what the terminal shows after
+// a present.
+
+#    if KORE_OS_POSIX
+
+#        include <sys/socket.h>
+#        include <sys/stat.h>
+#        include <sys/un.h>
+#        include <unistd.h>
+
+// Frames a client may have waiting before it is considered to be lagging.
+#        ifndef TERM_BROADCAST_MAX_QUEUED
+#            define TERM_BROADCAST_MAX_QUEUED 8
+#        endif
+
+typedef struct {
+    u32   refs;
+    usize size;
+    u8    data[];
+} TermBroadcastFrame;
+
+typedef struct {
+    int                 fd;
+    TermBroadcastFrame* queue[TERM_BROADCAST_MAX_QUEUED];
+    u32                 head;   // Index of the oldest waiting frame
+    u32                 count;  // Frames waiting
+    usize               offset; // Bytes of the oldest frame already sent
+    bool                keyframe_due;
+} TermBroadcastClient;
+
+typedef struct {
+    int listener;
+    Array(TermBroadcastClient) clients;
+    struct sockaddr_un address;
+} TermBroadcast;
+
+global_variable TermBroadcast g_term_broadcast = {.listener = -1};
+
+internal void _term_broadcast_start(void)
+{
+    TermBroadcast* cast = &g_term_broadcast;
+    cstr           path = g_term.broadcast_path;
+    if (!path) {
+        return;
+    }
+
+    cast->address = (struct sockaddr_un){.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(cast->address.sun_path)) {
+        eprn("Broadcast socket path is too long: %s", path);
+        return;
+    }
+    strcpy(cast->address.sun_path, path);
+
+    // A socket left behind by an earlier run would stop bind() working.
+    struct stat info;
+    if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        unlink(path);
+    }
+    struct sockaddr* address = (struct sockaddr*)&cast->address;
+    int              fd      = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, address, sizeof(cast->address)) != 0 ||
+        listen(fd, 8) != 0) {
+        eprn("Cannot broadcast on %s: %s", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    cast->listener = fd;
+}
+
+internal void _term_broadcast_release(TermBroadcastFrame* frame)
+{
+    if (--frame->refs == 0) {
+        KORE_FREE(frame);
+    }
+}
+
+// Drops a client's waiting frames, keeping the oldest if it is part written
+// so that the stream stays intact.
+internal void _term_broadcast_drop(TermBroadcastClient* client, bool keep_head)
+{
+    u32 keep = keep_head && client->offset > 0 ? 1 : 0;
+    for (u32 i = keep; i < client->count; ++i) {
+        u32 slot = (client->head + i) % TERM_BROADCAST_MAX_QUEUED;
+        _term_broadcast_release(client->queue[slot]);
+    }
+    client->count = keep;
+    if (keep == 0) {
+        client->offset = 0;
+    }
+}
+
+internal void _term_broadcast_stop(void)
+{
+    TermBroadcast* cast = &g_term_broadcast;
+    if (cast->listener < 0) {
+        return;
+    }
+
+    for (usize i = 0; i < array_count(cast->clients); ++i) {
+        _term_broadcast_drop(&cast->clients[i], false);
+        close(cast->clients[i].fd);
+    }
+    array_free(cast->clients);
+    close(cast->listener);
+    unlink(cast->address.sun_path);
+    cast->listener       = -1;
+    g_term_stats.clients = 0;
+}
+
+internal void _term_broadcast_accept(void)
+{
+    TermBroadcast* cast = &g_term_broadcast;
+    int            fd;
+    while ((fd = accept(cast->listener, NULL, NULL)) >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+#        ifdef SO_NOSIGPIPE
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#        endif
+        array_push(cast->clients,
+                   (TermBroadcastClient){.fd = fd, .keyframe_due = true});
+    }
+}
+
+// Queues a frame for a client, or marks it as lagging if its queue is full.
+internal void _term_broadcast_push(TermBroadcastClient* client,
+                                   TermBroadcastFrame*  frame)
+{
+    if (client->count == TERM_BROADCAST_MAX_QUEUED) {
+        _term_broadcast_drop(client, true);
+        client->keyframe_due = true;
+        return;
+    }
+
+    u32 slot = (client->head + client->count) % TERM_BROADCAST_MAX_QUEUED;
+    client->queue[slot] = frame;
+    client->count += 1;
+    frame->refs += 1;
+}
+
+// Sends as much of a client's waiting frames as it will take.  Returns false
+// if the client has gone.
+internal bool _term_broadcast_flush(TermBroadcastClient* client)
+{
+#        ifdef MSG_NOSIGNAL
+    int flags = MSG_NOSIGNAL;
+#        else
+    int flags = 0;
+#        endif
+
+    // Clients send nothing, so reading the end of the stream is how one that
+    // has closed its end is noticed when there is nothing to send it.
+    u8      discard[256];
+    ssize_t received;
+    do {
+        received = recv(client->fd, discard, sizeof(discard), 0);
+    } while (received > 0);
+    if (received == 0) {
+        return false;
+    }
+
+    while (client->count > 0) {
+        struct iovec vectors[TERM_BROADCAST_MAX_QUEUED];
+        for (u32 i = 0; i < client->count; ++i) {
+            TermBroadcastFrame* frame =
+                client->queue[(client->head + i) % TERM_BROADCAST_MAX_QUEUED];
+            usize skip = i == 0 ? client->offset : 0;
+            vectors[i] = (struct iovec){.iov_base = frame->data + skip,
+                                        .iov_len  = frame->size - skip};
+        }
+
+        struct msghdr message = {.msg_iov    = vectors,
+                                 .msg_iovlen = client->count};
+        ssize_t       written = sendmsg(client->fd, &message, flags);
+        if (written < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+
+        // Release the frames that went completely.
+        usize left = (usize)written + client->offset;
+        while (client->count > 0) {
+            TermBroadcastFrame* frame = client->queue[client->head];
+            if (left < frame->size) {
+                break;
+            }
+            left -= frame->size;
+            _term_broadcast_release(frame);
+            client->head = (client->head + 1) % TERM_BROADCAST_MAX_QUEUED;
+            client->count -= 1;
+        }
+        client->offset = client->count > 0 ? left : 0;
+    }
+    return true;
+}
+
+internal TermBroadcastFrame* _term_broadcast_alloc(usize size)
+{
+    TermBroadcastFrame* frame =
+        (TermBroadcastFrame*)KORE_ALLOC(sizeof(TermBroadcastFrame) + size);
+    frame->refs = 1;
+    frame->size = size;
+    return frame;
+}
+
+internal TermBroadcastFrame* _term_broadcast_keyframe(void)
+{
+    string              screen = _term_fb_encode_screen();
+    TermBroadcastFrame* frame  = _term_broadcast_alloc(screen.count);
+    memcpy(frame->data, screen.data, screen.count);
+    g_term_stats.keyframes += 1;
+    return frame;
+}
+
+// Sends a presented frame, made of `count` parts, to the clients.  With no
+// parts nothing changed, but new and lagging clients are still caught up.
+internal void _term_broadcast_frame(const string* parts, usize count)
+{
+    TermBroadcast* cast = &g_term_broadcast;
+    if (cast->listener < 0) {
+        return;
+    }
+    _term_broadcast_accept();
+
+    TermBroadcastFrame* frame = NULL;
+    if (count > 0) {
+        usize size = 0;
+        for (usize i = 0; i < count; ++i) {
+            size += parts[i].count;
+        }
+        frame     = _term_broadcast_alloc(size);
+        u8* bytes = frame->data;
+        for (usize i = 0; i < count; ++i) {
+            memcpy(bytes, parts[i].data, parts[i].count);
+            bytes += parts[i].count;
+        }
+    }
+
+    // A client waiting for the whole screen skips the frame, as the whole
+    // screen includes it.
+    TermBroadcastFrame* keyframe = NULL;
+    for (usize i = 0; i < array_count(cast->clients); ++i) {
+        TermBroadcastClient* client = &cast->clients[i];
+        if (frame && !client->keyframe_due) {
+            _term_broadcast_push(client, frame);
+        }
+        if (client->keyframe_due &&
+            client->count < TERM_BROADCAST_MAX_QUEUED) {
+            if (!keyframe) {
+                keyframe = _term_broadcast_keyframe();
+            }
+            _term_broadcast_push(client, keyframe);
+            client->keyframe_due = false;
+        }
+    }
+
+    // Send what each client will take, forgetting those that have gone.
+    for (usize i = array_count(cast->clients); i-- > 0;) {
+        TermBroadcastClient* client = &cast->clients[i];
+        if (!_term_broadcast_flush(client)) {
+            _term_broadcast_drop(client, false);
+            close(client->fd);
+            array_delete(cast->clients, i);
+        }
+    }
+    g_term_stats.clients = array_count(cast->clients);
+
+    if (frame) {
+        _term_broadcast_release(frame);
+    }
+    if (keyframe) {
+        _term_broadcast_release(keyframe);
+    }
+}
+
+#    else
+
+internal void _term_broadcast_start(void) {}
+internal void _term_broadcast_stop(void) {}
+internal void _term_broadcast_frame(const string* parts, usize count)
+{
+    KORE_UNUSED(parts);
+    KORE_UNUSED(count);
+}
+
+#    endif // KORE_OS_POSIX
+
+//------------------------------------------------------------------------------
+// Recordings
+//
+// Records are gathered in a buffer and written to the file when it fills, at
+// each keyframe and when the terminal stops, so recording costs a copy per
+// frame and an occasional fwrite().
+
+#    define TERM_RECORD_MAGIC "TERMREC"
+#    define TERM_RECORD_VERSION 1
+#    define TERM_RECORD_HEADER_SIZE 8
+
+// Bytes of records buffered before they are written to the file.
+#    ifndef TERM_RECORD_BUFFER_SIZE
+#        define TERM_RECORD_BUFFER_SIZE KORE_KB(256)
+#    endif
+
+typedef struct {
+    FILE*     file;
+    Array(u8) buffer;
+    TimePoint start;
+    u64       time_us;     // Time of the last record
+    u64       keyframe_us; // Time of the last keyframe
+    TermSize  size;        // Screen size at the last keyframe
+} TermRecorder;
+
+global_variable TermRecorder g_term_recorder;
+
+internal void _term_record_flush(void)
+{
+    TermRecorder* rec   = &g_term_recorder;
+    usize         bytes = array_count(rec->buffer);
+    if (bytes > 0) {
+        fwrite(rec->buffer, 1, bytes, rec->file);
+        fflush(rec->file);
+        array_clear(rec->buffer);
+    }
+}
+
+internal void _term_record_bytes(const void* data, usize size)
+{
+    TermRecorder* rec   = &g_term_recorder;
+    usize         count = array_count(rec->buffer);
+    if (size == 0) {
+        return;
+    }
+    array_reserve(rec->buffer, count + size);
+    memcpy(rec->buffer + count, data, size);
+}
+
+// Writes a varint into `out`, which must have room for 10 bytes, returning
+// its length.
+internal usize _term_record_varint(u8* out, u64 value)
+{
+    usize length = 0;
+    while (value >= 0x80) {
+        out[length++] = (u8)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (u8)value;
+    return length;
+}
+
+// Appends a record whose payload is a prefix followed by some parts.
+internal void _term_record_append(TermRecordKind kind,
+                                  u64            time_us,
+                                  string         prefix,
+                                  const string*  parts,
+                                  usize          count)
+{
+    TermRecorder* rec  = &g_term_recorder;
+    usize         size = prefix.count;
+    for (usize i = 0; i < count; ++i) {
+        size += parts[i].count;
+    }
+
+    u8    header[21];
+    usize length     = 0;
+    header[length++] = (u8)kind;
+    length += _term_record_varint(header + length, time_us - rec->time_us);
+    length += _term_record_varint(header + length, size);
+    _term_record_bytes(header, length);
+    _term_record_bytes(prefix.data, prefix.count);
+    for (usize i = 0; i < count; ++i) {
+        _term_record_bytes(parts[i].data, parts[i].count);
+    }
+    rec->time_us = time_us;
+}
+
+internal void _term_record_start(void)
+{
+    TermRecorder* rec = &g_term_recorder;
+    if (!g_term.record_path) {
+        return;
+    }
+
+    *rec      = (TermRecorder){0};
+    rec->file = fopen(g_term.record_path, "wb");
+    if (!rec->file) {
+        eprn("Cannot record to %s", g_term.record_path);
+        return;
+    }
+    rec->start = time_now();
+    u8 header[TERM_RECORD_HEADER_SIZE]  = TERM_RECORD_MAGIC;
+    header[TERM_RECORD_HEADER_SIZE - 1] = TERM_RECORD_VERSION;
+    _term_record_bytes(header, sizeof(header));
+}
+
+internal void _term_record_stop(void)
+{
+    TermRecorder* rec = &g_term_recorder;
+    if (rec->file) {
+        _term_record_flush();
+        fclose(rec->file);
+        array_free(rec->buffer);
+        *rec = (TermRecorder){0};
+    }
+}
+
+// Records a frame made of `count` parts, followed by a keyframe if one is
+// due.
+internal void _term_record_frame(const string* parts, usize count)
+{
+    TermRecorder* rec = &g_term_recorder;
+    if (!rec->file) {
+        return;
+    }
+
+    u64 now = time_duration_to_us(time_elapsed(rec->start, time_now()));
+    _term_record_append(TERM_RECORD_FRAME, now, (string){0}, parts, count);
+
+    u32  interval_ms = g_term.record_keyframe_ms ? g_term.record_keyframe_ms
+                                                 : 2000;
+    bool resized     = rec->size.width != g_term_fb_size.width ||
+                   rec->size.height != g_term_fb_size.height;
+    if (resized || now - rec->keyframe_us >= interval_ms * 1000ull) {
+        string screen = _term_fb_encode_screen();
+        u8     size[20];
+        usize  length = _term_record_varint(size, g_term_fb_size.width);
+        length += _term_record_varint(size + length, g_term_fb_size.height);
+        _term_record_append(TERM_RECORD_KEYFRAME,
+                            now,
+                            string_from(size, length),
+                            &screen,
+                            1);
+        rec->keyframe_us = now;
+        rec->size        = g_term_fb_size;
+        _term_record_flush();
+    } else if (array_count(rec->buffer) >= TERM_RECORD_BUFFER_SIZE) {
+        _term_record_flush();
+    }
+}
+
+// Reads a varint, returning false if the data runs out first.
+internal bool _term_record_read_varint(TermRecordReader* reader, u64* out)
+{
+    u64 value = 0;
+    for (u32 shift = 0; shift < 64; shift += 7) {
+        if (reader->offset >= reader->data.count) {
+            return false;
+        }
+        u8 byte = reader->data.data[reader->offset++];
+        value |= (u64)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *out = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool term_record_reader_init(TermRecordReader* reader, string data)
+{
+    *reader = (TermRecordReader){.data = data};
+    const u8* header = data.data;
+    if (data.count < TERM_RECORD_HEADER_SIZE ||
+        memcmp(header, TERM_RECORD_MAGIC, TERM_RECORD_HEADER_SIZE - 1) != 0 ||
+        header[TERM_RECORD_HEADER_SIZE - 1] != TERM_RECORD_VERSION) {
+        return false;
+    }
+    reader->offset = TERM_RECORD_HEADER_SIZE;
+    return true;
+}
+
+bool term_record_next(TermRecordReader* reader, TermRecord* out_record)
+{
+    // Nothing is consumed unless the whole record is there.
+    TermRecordReader next = *reader;
+    u64              delta, size;
+    if (next.offset >= next.data.count) {
+        return false;
+    }
+    u8 kind = next.data.data[next.offset++];
+    if ((kind != TERM_RECORD_FRAME && kind != TERM_RECORD_KEYFRAME) ||
+        !_term_record_read_varint(&next, &delta) ||
+        !_term_record_read_varint(&next, &size) ||
+        size > next.data.count - next.offset) {
+        return false;
+    }
+
+    TermRecord record = {.kind = (TermRecordKind)kind};
+    usize      end    = next.offset + size;
+    if (kind == TERM_RECORD_KEYFRAME) {
+        u64 width, height;
+        if (!_term_record_read_varint(&next, &width) ||
+            !_term_record_read_varint(&next, &height) || next.offset > end) {
+            return false;
+        }
+        record.size = (TermSize){(u16)width, (u16)height};
+    }
+    next.time_us += delta;
+    record.time_us = next.time_us;
+    record.output  = string_from(next.data.data + next.offset,
+                                end - next.offset);
+    next.offset    = end;
+
+    *reader     = next;
+    *out_record = record;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void term_fb_present(void)
+{
+    TermSize    size         = g_term_fb_size;
+    TimePoint   encode_start = time_now();
+    Arena*      arena        = &g_term_arena;
+    TermEncoder enc;
+
+    if (g_term_writer.running) {
+        arena = _term_writer_acquire();
+        if (!arena) {
+            g_term_stats.dropped_frames += 1;
+            return;
+        }
+    }
+    arena_reset(arena);
+    _term_enc_begin(&enc, arena);
+
+    // We go through each row looking for dirty cells that differ from the
+    // front buffer (what the terminal is currently showing).  Cells that have
+    // not really changed are skipped.
+    //
+    // The encoder tracks where the terminal's cursor is and which colours are
+    // set, so for each changed cell we only send the cheapest cursor motion
+    // to reach it and the colour attributes that differ.
+    //
+    // The u32 characters are encoded into a UTF-8 sequence.
+    //
+    // The frame is wrapped in synchronised update markers (DEC mode 2026) so
+    // terminals that support them show it all at once without tearing.
+    //
+    // Any queued scrolls are sent first using scroll margins (DECSTBM) and
+    // SU/SD, as the front buffer already assumes they have happened.
+
+    _term_enc_reserve(&enc, TERM_ENC_MAX_CELL_BYTES);
+    _term_enc_literal(&enc, "\x1b[?2026h");
+    if (g_cursor_visible) {
+        _term_enc_literal(&enc, "\x1b[?25l");
+    }
+
+    usize scroll_count = array_count(g_term_fb_scrolls);
+    for (usize i = 0; i < scroll_count; ++i) {
+        TermScroll scroll  = g_term_fb_scrolls[i];
+        bool       margins = scroll.top != 0 || scroll.bottom != size.height;
+
+        _term_enc_reserve(&enc, TERM_ENC_MAX_CELL_BYTES);
+        if (margins) {
+            _term_enc_literal(&enc, "\x1b[");
+            _term_enc_uint(&enc, (u32)scroll.top + 1);
+            _term_enc_byte(&enc, ';');
+            _term_enc_uint(&enc, scroll.bottom);
+            _term_enc_byte(&enc, 'r');
+        }
+        _term_enc_literal(&enc, "\x1b[");
+        _term_enc_uint(&enc, (u32)abs(scroll.dy));
+        _term_enc_byte(&enc, scroll.dy > 0 ? 'S' : 'T');
+        if (margins) {
+            // Resetting the margins also homes the cursor.
+            _term_enc_literal(&enc, "\x1b[r");
+            enc.x = 0;
+            enc.y = 0;
+        }
+    }
+    array_clear(g_term_fb_scrolls);
+
+    // Only rows with dirty cells are visited, and only the dirty cells
+    // within them.  Large frames are encoded in bands, in parallel.
+    usize bands = 1;
+    if (g_term.present_threads != 1) {
+        bands = _term_fb_split_bands();
+    }
+
+    string parts[TERM_PRESENT_MAX_THREADS + 2];
+    usize  part_count  = 0;
+    usize  dirty_cells = 0;
+    bool   changed     = scroll_count > 0;
+
+    if (bands > 1) {
+        thread_pool_run(
+            &g_term_present_pool, _term_fb_encode_band, g_term_bands, bands);
+
+        // The header stays where it is in the output arena, followed by each
+        // band's output and then the footer.  The band arenas are reused by
+        // the next frame, so a frame for the writer thread is gathered into
+        // its own arena after the header.
+        usize header_bytes  = _term_enc_end(&enc);
+        parts[part_count++] = string_from(enc.start, header_bytes);
+        for (usize i = 0; i < bands; ++i) {
+            TermBand* band  = &g_term_bands[i];
+            u8*       bytes = band->enc.start;
+            dirty_cells += band->dirty_cells;
+            changed |= band->bytes > 0;
+            if (g_term_writer.running) {
+                bytes = (u8*)arena_alloc(arena, band->bytes);
+                memcpy(bytes, band->enc.start, band->bytes);
+            }
+            parts[part_count++] = string_from(bytes, band->bytes);
+        }
+        _term_enc_begin(&enc, arena);
+    } else {
+        dirty_cells = _term_fb_encode_rows(&enc, 0, size.height);
+        changed |= enc.y >= 0;
+    }
+
+    memset(g_term_fb_dirty_rows, 0, array_size(g_term_fb_dirty_rows));
+    g_term_stats.dirty_cells = dirty_cells;
+
+    if (!changed) {
+        // Nothing changed so there is nothing to send.
+        _term_enc_end(&enc);
+        g_term_stats.frame_bytes = 0;
+        g_term_stats.encode_time = time_elapsed(encode_start, time_now());
+        g_term_stats.write_time  = 0;
+        _term_broadcast_frame(NULL, 0);
+        return;
+    }
+
+    _term_enc_reserve(&enc, TERM_ENC_MAX_CELL_BYTES);
+    if (g_cursor_visible) {
+        _term_enc_literal(&enc, "\x1b[?25h");
+    }
+    _term_enc_literal(&enc, "\x1b[?2026l");
+    parts[part_count++] = string_from(enc.start, _term_enc_end(&enc));
+
+    usize frame_bytes = 0;
+    for (usize i = 0; i < part_count; ++i) {
+        frame_bytes += parts[i].count;
+    }
+
+    // Hand the frame straight to the terminal in one write, or to the writer
+    // thread, in which case the parts follow each other in its arena.
+    TimePoint write_start = time_now();
+    if (g_term_writer.running) {
+        _term_writer_queue(arena, string_from(parts[0].data, frame_bytes));
+    } else if (part_count == 1) {
+        _term_output(parts[0].data, parts[0].count);
+    } else {
+        _term_output_parts(parts, part_count);
+    }
+    TimePoint write_end = time_now();
+    _term_broadcast_frame(parts, part_count);
+    _term_record_frame(parts, part_count);
+
+    g_term_stats.frame_count += 1;
+    g_term_stats.frame_bytes = frame_bytes;
+    g_term_stats.total_bytes += frame_bytes;
+    g_term_stats.encode_time = time_elapsed(encode_start, write_start);
+    g_term_stats.write_time  = time_elapsed(write_start, write_end);
+}
+
+TermStats term_stats(void) { return g_term_stats; }
+
+//------------------------------------------------------------------------------
+// Frame pacing
+//
+// The interval between frames grows by half whenever the terminal falls
+// behind: when output from the previous frame is still queued as the next is
+// presented, when presenting takes over half the interval, or when the writer
+// thread drops the frame.  It shrinks by an eighth after each frame that goes
+// out easily, so that a terminal that only just keeps up is not flooded again
+// straight away.
+
+// The longest interval between frames.
+#    define TERM_FRAME_MAX_INTERVAL_MS 1000
+
+typedef struct {
+    TimePoint    begin;    // When the last frame began
+    TimePoint    due;      // When the next frame is due
+    TimeDuration interval; // Current interval between frames
+} TermPacer;
+
+global_variable TermPacer g_term_pacer;
+
+// The first frame is due at once.
+internal void _term_frame_reset(void) { g_term_pacer = (TermPacer){0}; }
+
+internal TimeDuration _term_frame_target(void)
+{
+    u32 rate = g_term.frame_rate ? g_term.frame_rate : 60;
+    return time_from_us(1000000 / rate);
+}
+
+bool term_frame_begin(void)
+{
+    TermPacer* pacer  = &g_term_pacer;
+    TimePoint  now    = time_now();
+    bool       events = g_term.event_queue.count > 0;
+
+    // term_wait returns early for events, and may do so for a signal too.
+    while (!events && now < pacer->due) {
+        events = term_wait(time_elapsed(now, pacer->due));
+        now    = time_now();
+    }
+    pacer->begin = now;
+    return events;
+}
+
+void term_frame_end(void)
+{
+    TermPacer*   pacer   = &g_term_pacer;
+    TimeDuration target  = _term_frame_target();
+    usize        backlog = _term_output_backlog();
+    u64          dropped = g_term_stats.dropped_frames;
+
+    TimePoint start = time_now();
+    term_fb_present();
+    TimePoint    end  = time_now();
+    TimeDuration cost = time_elapsed(start, end);
+
+    TimeDuration interval = KORE_MAX(pacer->interval, target);
+    if (backlog > 0 || cost > interval / 2 ||
+        g_term_stats.dropped_frames != dropped) {
+        interval += interval / 2;
+    } else {
+        interval -= interval / 8;
+    }
+    interval = KORE_MIN(interval, time_from_ms(TERM_FRAME_MAX_INTERVAL_MS));
+    interval = KORE_MAX(interval, target);
+
+    pacer->interval = interval;
+    pacer->due      = KORE_MAX(time_add_duration(pacer->begin, interval), end);
+    g_term_stats.output_backlog = backlog;
+    g_term_stats.frame_rate     = 1.0 / time_secs(interval);
+}
+
+//------------------------------------------------------------------------------
+// Headless terminal
+//
+// The output is only captured when it is written.  It is parsed into the
+// shadow screen when the screen is next looked at, so capturing costs no more
+// than a copy and benchmarks measure the encoder rather than the parser.
+
+#    define TERM_VT_MAX_PARAMS 16
+
+typedef enum {
+    TERM_VT_GROUND,
+    TERM_VT_ESC,
+    TERM_VT_CSI,
+    TERM_VT_OSC,
+} TermVtState;
+
+typedef struct {
+    Array(u8) output;  // Bytes sent since the last clear
+    usize     applied; // Bytes of the output already applied to the screen
+
+    // The shadow screen.
+    TermHeadlessCell* cells;
+    TermSize          size;
+    u16               x;
+    u16               y;
+    bool              wrap;   // The next character goes on the next line
+    u16               top;    // Scroll region rows, inclusive
+    u16               bottom;
+    u32               ink;
+    u32               paper;
+    u32               last; // Last character printed, for REP
+
+    // Parser state.
+    TermVtState state;
+    bool        private; // The CSI sequence starts with one of "<=>?"
+    u32         params[TERM_VT_MAX_PARAMS];
+    u32         param_count;
+    u32         code;           // Character being decoded
+    u32         utf8_remaining; // Continuation bytes still to come
+} TermHeadless;
+
+global_variable TermHeadless g_term_headless;
+
+internal void _term_headless_start(void)
+{
+    g_term_headless = (TermHeadless){0};
+    term_headless_resize(g_term.size);
+}
+
+internal void _term_headless_done(void)
+{
+    array_free(g_term_headless.output);
+    if (g_term_headless.cells) {
+        KORE_FREE(g_term_headless.cells);
+    }
+    g_term_headless = (TermHeadless){0};
+}
+
+internal void _term_headless_capture(const u8* data, usize size)
+{
+    TermHeadless* vt = &g_term_headless;
+
+    // The writer thread may be capturing a frame at the same time.
+    mutex_lock(&g_kore_output_mutex);
+    usize count = array_count(vt->output);
+    array_reserve(vt->output, count + size);
+    memcpy(vt->output + count, data, size);
+    mutex_unlock(&g_kore_output_mutex);
+}
+
+internal bool _term_headless_wait(TimeDuration timeout)
+{
+    if (g_term.event_queue.count == 0 && timeout != TERM_WAIT_FOREVER) {
+        time_sleep_ms((u32)_term_timeout_ms(timeout));
+    }
+    return g_term.event_queue.count > 0;
+}
+
+//------------------------------------------------------------------------------
+
+// Blanks cells with the current colours, as erasing does on a terminal.
+internal void _term_vt_blank(TermHeadless* vt, usize index, usize count)
+{
+    for (usize i = 0; i < count; ++i) {
+        vt->cells[index + i] = (TermHeadlessCell){
+            .ch = ' ', .ink = vt->ink, .paper = vt->paper};
+    }
+}
+
+// Scrolls the scroll region up by n rows, or down if n is negative.
+internal void _term_vt_scroll(TermHeadless* vt, i32 n)
+{
+    usize width  = vt->size.width;
+    i32   height = vt->bottom - vt->top + 1;
+    i32   rows   = KORE_MIN(abs(n), height);
+    usize top    = vt->top * width;
+    usize kept   = (usize)(height - rows) * width;
+    usize moved  = (usize)rows * width;
+
+    if (n > 0) {
+        memmove(vt->cells + top,
+                vt->cells + top + moved,
+                kept * sizeof(TermHeadlessCell));
+        _term_vt_blank(vt, top + kept, moved);
+    } else if (n < 0) {
+        memmove(vt->cells + top + moved,
+                vt->cells + top,
+                kept * sizeof(TermHeadlessCell));
+        _term_vt_blank(vt, top, moved);
+    }
+}
+
+internal void _term_vt_line_feed(TermHeadless* vt)
+{
+    if (vt->y == vt->bottom) {
+        _term_vt_scroll(vt, 1);
+    } else if (vt->y + 1 < vt->size.height) {
+        vt->y += 1;
+    }
+}
+
+internal void _term_vt_print(TermHeadless* vt, u32 ch)
+{
+    int width = term_char_width(ch);
+    if (width <= 0) {
+        return;
+    }
+
+    u16 screen_width = vt->size.width;
+    if (vt->wrap || vt->x + width > screen_width) {
+        vt->x    = 0;
+        vt->wrap = false;
+        _term_vt_line_feed(vt);
+    }
+
+    // Overwriting either half of a wide character erases the other half.
+    TermHeadlessCell* row = vt->cells + (usize)vt->y * screen_width;
+    u16               x   = vt->x;
+    if (row[x].ch == TERM_HEADLESS_WIDE_TAIL && x > 0) {
+        row[x - 1].ch = ' ';
+    }
+    if (x + width < screen_width &&
+        row[x + width].ch == TERM_HEADLESS_WIDE_TAIL) {
+        row[x + width].ch = ' ';
+    }
+
+    row[x] = (TermHeadlessCell){.ch = ch, .ink = vt->ink, .paper = vt->paper};
+    if (width == 2) {
+        row[x + 1] = (TermHeadlessCell){
+            .ch = TERM_HEADLESS_WIDE_TAIL, .ink = vt->ink, .paper = vt->paper};
+    }
+    vt->last = ch;
+
+    // Like a terminal, stop on the last column until the next character.
+    if (x + width >= screen_width) {
+        vt->x    = screen_width - 1;
+        vt->wrap = true;
+    } else {
+        vt->x = x + (u16)width;
+    }
+}
+
+// Returns a CSI parameter, or the default if it is missing or 0.
+internal u32 _term_vt_param(TermHeadless* vt, u32 index, u32 fallback)
+{
+    if (index < vt->param_count && vt->params[index] != 0) {
+        return vt->params[index];
+    }
+    return fallback;
+}
+
+internal void _term_vt_sgr(TermHeadless* vt)
+{
+    if (vt->param_count == 0) {
+        vt->ink   = TERM_HEADLESS_DEFAULT;
+        vt->paper = TERM_HEADLESS_DEFAULT;
+        return;
+    }
+
+    for (u32 i = 0; i < vt->param_count; ++i) {
+        u32  p      = vt->params[i];
+        u32* colour = p < 40 || (p >= 90 && p < 100) ? &vt->ink : &vt->paper;
+
+        if (p == 0) {
+            vt->ink   = TERM_HEADLESS_DEFAULT;
+            vt->paper = TERM_HEADLESS_DEFAULT;
+        } else if (p == 38 || p == 48) {
+            if (_term_vt_param(vt, i + 1, 0) == 2 && i + 4 < vt->param_count) {
+                *colour = (vt->params[i + 2] & 0xFF) << 16 |
+                          (vt->params[i + 3] & 0xFF) << 8 |
+                          (vt->params[i + 4] & 0xFF);
+                i += 4;
+            } else if (i + 2 < vt->param_count) {
+                *colour = vt->params[i + 2];
+                i += 2;
+            }
+        } else if (p == 39 || p == 49) {
+            *colour = TERM_HEADLESS_DEFAULT;
+        } else if ((p >= 30 && p <= 37) || (p >= 40 && p <= 47)) {
+            *colour = p % 10;
+        } else if ((p >= 90 && p <= 97) || (p >= 100 && p <= 107)) {
+            *colour = p % 10 + 8;
+        }
+    }
+}
+
+internal void _term_vt_csi(TermHeadless* vt, u8 final)
+{
+    if (vt->private) {
+        // Modes such as the cursor visibility do not change the screen.
+        return;
+    }
+
+    TermSize size = vt->size;
+    u32      n    = _term_vt_param(vt, 0, 1);
+
+    if (final != 'm' && final != 'b') {
+        vt->wrap = false;
+    }
+
+    switch (final) {
+    case 'H':
+    case 'f':
+        vt->y = (u16)KORE_MIN(n, size.height) - 1;
+        vt->x = (u16)KORE_MIN(_term_vt_param(vt, 1, 1), size.width) - 1;
+        break;
+    case 'A': vt->y = (u16)(vt->y - KORE_MIN(n, vt->y)); break;
+    case 'B': vt->y = (u16)KORE_MIN(vt->y + n, size.height - 1u); break;
+    case 'C': vt->x = (u16)KORE_MIN(vt->x + n, size.width - 1u); break;
+    case 'D': vt->x = (u16)(vt->x - KORE_MIN(n, vt->x)); break;
+    case 'G': vt->x = (u16)KORE_MIN(n, size.width) - 1; break;
+    case 'd': vt->y = (u16)KORE_MIN(n, size.height) - 1; break;
+    case 'm': _term_vt_sgr(vt); break;
+    case 'S': _term_vt_scroll(vt, (i32)n); break;
+    case 'T': _term_vt_scroll(vt, -(i32)n); break;
+
+    case 'b':
+        for (u32 i = 0; i < n; ++i) {
+            _term_vt_print(vt, vt->last);
+        }
+        break;
+
+    case 'r':
+        {
+            u32 bottom = _term_vt_param(vt, 1, size.height);
+            vt->top    = (u16)KORE_MIN(n, size.height) - 1;
+            vt->bottom = (u16)KORE_MIN(bottom, size.height) - 1;
+            if (vt->top >= vt->bottom) {
+                vt->top    = 0;
+                vt->bottom = size.height - 1;
+            }
+            vt->x = 0;
+            vt->y = 0;
+        }
+        break;
+
+    case 'J':
+        if (_term_vt_param(vt, 0, 0) == 2) {
+            _term_vt_blank(vt, 0, (usize)size.width * size.height);
+        }
+        break;
+    }
+}
+
+internal void _term_vt_byte(TermHeadless* vt, u8 byte)
+{
+    switch (vt->state) {
+    case TERM_VT_GROUND:
+        if (vt->utf8_remaining > 0 && (byte & 0xC0) == 0x80) {
+            vt->code = (vt->code << 6) | (byte & 0x3F);
+            if (--vt->utf8_remaining == 0) {
+                _term_vt_print(vt, vt->code);
+            }
+            return;
+        }
+        vt->utf8_remaining = 0;
+
+        if (byte == 0x1B) {
+            vt->state = TERM_VT_ESC;
+        } else if (byte == '\r') {
+            vt->x    = 0;
+            vt->wrap = false;
+        } else if (byte == '\n') {
+            _term_vt_line_feed(vt);
+            vt->wrap = false;
+        } else if (byte == '\b') {
+            vt->x    = vt->x > 0 ? vt->x - 1 : 0;
+            vt->wrap = false;
+        } else if (byte >= 0x20 && byte < 0x7F) {
+            _term_vt_print(vt, byte);
+        } else if (byte >= 0xC0) {
+            vt->utf8_remaining = byte >= 0xF0 ? 3 : byte >= 0xE0 ? 2 : 1;
+            vt->code           = byte & (0x3F >> vt->utf8_remaining);
+        }
+        break;
+
+    case TERM_VT_ESC:
+        vt->state = byte == '['   ? TERM_VT_CSI
+                    : byte == ']' ? TERM_VT_OSC
+                                  : TERM_VT_GROUND;
+        vt->private     = false;
+        vt->param_count = 0;
+        break;
+
+    case TERM_VT_CSI:
+        if (byte >= '0' && byte <= '9') {
+            if (vt->param_count == 0) {
+                vt->params[vt->param_count++] = 0;
+            }
+            u32* param = &vt->params[vt->param_count - 1];
+            *param     = KORE_MIN(*param * 10 + (byte - '0'), 0xFFFFu);
+        } else if (byte == ';') {
+            if (vt->param_count == 0) {
+                vt->params[vt->param_count++] = 0;
+            }
+            if (vt->param_count < TERM_VT_MAX_PARAMS) {
+                vt->params[vt->param_count++] = 0;
+            }
+        } else if (byte >= '<' && byte <= '?') {
+            vt->private = true;
+        } else if (byte >= 0x40 && byte <= 0x7E) {
+            _term_vt_csi(vt, byte);
+            vt->state = TERM_VT_GROUND;
+        }
+        break;
+
+    case TERM_VT_OSC:
+        // Ended by BEL or ST (ESC \).
+        if (byte == 0x07) {
+            vt->state = TERM_VT_GROUND;
+        } else if (byte == 0x1B) {
+            vt->state = TERM_VT_ESC;
+        }
+        break;
+    }
+}
+
+// Applies the output captured since the last call to the shadow screen.
+internal void _term_headless_apply(void)
+{
+    TermHeadless* vt = &g_term_headless;
+
+    _term_writer_wait();
+    usize count = array_count(vt->output);
+    for (usize i = vt->applied; i < count; ++i) {
+        _term_vt_byte(vt, vt->output[i]);
+    }
+    vt->applied = count;
+}
+
+//------------------------------------------------------------------------------
+
+string term_headless_output(void)
+{
+    _term_writer_wait();
+    return string_from(g_term_headless.output,
+                       array_count(g_term_headless.output));
+}
+
+void term_headless_clear_output(void)
+{
+    _term_headless_apply();
+    array_clear(g_term_headless.output);
+    g_term_headless.applied = 0;
+}
+
+// Puts the shadow screen back as a terminal starts: blank, in the default
+// colours, with the cursor at the top left and no scroll region.
+internal void _term_headless_blank(TermHeadless* vt)
+{
+    vt->x              = 0;
+    vt->y              = 0;
+    vt->wrap           = false;
+    vt->top            = 0;
+    vt->bottom         = vt->size.height - 1;
+    vt->ink            = TERM_HEADLESS_DEFAULT;
+    vt->paper          = TERM_HEADLESS_DEFAULT;
+    vt->state          = TERM_VT_GROUND;
+    vt->utf8_remaining = 0;
+    _term_vt_blank(vt, 0, (usize)vt->size.width * vt->size.height);
+}
+
+void term_headless_resize(TermSize size)
+{
+    KORE_ASSERT(g_term.headless, "The terminal is not headless");
+    TermHeadless* vt = &g_term_headless;
+
+    // The old screen is not kept, as the next present repaints everything.
+    _term_headless_apply();
+    usize cells = (usize)size.width * size.height;
+    if (vt->cells) {
+        KORE_FREE(vt->cells);
+    }
+    vt->cells = (TermHeadlessCell*)KORE_ALLOC(cells * sizeof(*vt->cells));
+    vt->size  = size;
+    _term_headless_blank(vt);
+
+    g_term.size = size;
+    TermEvent event;
+    event.kind = TERM_EVENT_RESIZE;
+    event.size = size;
+    _term_queue_event(event);
+    _term_fb_resize(size.width, size.height);
+}
+
+void term_headless_replay(string output)
+{
+    TermHeadless* vt = &g_term_headless;
+    _term_headless_apply();
+    _term_headless_blank(vt);
+    for (usize i = 0; i < output.count; ++i) {
+        _term_vt_byte(vt, output.data[i]);
+    }
+}
+
+TermHeadlessCell term_headless_cell(u16 x, u16 y)
+{
+    TermHeadless* vt = &g_term_headless;
+    _term_headless_apply();
+    if (x >= vt->size.width || y >= vt->size.height) {
+        return (TermHeadlessCell){0};
+    }
+    return vt->cells[(usize)y * vt->size.width + x];
+}
+
+usize term_headless_verify(void)
+{
+    TermHeadless* vt   = &g_term_headless;
+    TermSize      size = g_term_fb_size;
+
+    _term_headless_apply();
+    if (size.width != vt->size.width || size.height != vt->size.height) {
+        return (usize)size.width * size.height;
+    }
+
+    TermColourMode mode       = g_term.colour_mode;
+    usize          mismatches = 0;
+    for (u16 y = 0; y < size.height; ++y) {
+        usize row = (usize)y * size.width;
+        for (u16 x = 0; x < size.width;) {
+            usize index = row + x;
+            u32   ch;
+            u16   cells = _term_fb_cell_glyph(index, x, size.width, &ch);
+            u32   ink   = _term_colour_key(TERM_FB_INK(index), mode);
+            u32   paper = _term_colour_key(TERM_FB_PAPER(index), mode);
+
+            for (u16 i = 0; i < cells; ++i) {
+                TermHeadlessCell cell = vt->cells[index + i];
+                if (cell.ch != (i == 0 ? ch : TERM_HEADLESS_WIDE_TAIL) ||
+                    cell.ink != ink || cell.paper != paper) {
+                    mismatches += 1;
+                }
+            }
+            x += cells;
+        }
     }
 
-    pr("%s", output);
+    return mismatches;
 }
 
 //------------------------------------------------------------------------------
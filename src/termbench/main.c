@@ -0,0 +1,309 @@
+//------------------------------------------------------------------------------
+// Terminal framebuffer benchmark
+//
+// Times rectangle fills and presentation on a headless terminal, so no tty is
+// needed.  The presented frames are kept in memory and checked against the
+// framebuffer at the end:
+//
+//      ./build.sh -r termbench && ./_bin/termbench
+//
+// To compare framebuffer layouts, build again with the interleaved cells:
+//
+//      DEFINES="-D_GNU_SOURCE -DTERM_FB_INTERLEAVED=1" ./build.sh -r termbench
+//
+// DEFINES replaces the default defines, so any others that are needed must be
+// repeated.
+//------------------------------------------------------------------------------
+
+#define KORE_IMPLEMENTATION
+#include <kore/kore.h>
+#include <stdlib.h>
+#include <term/term.h>
+
+#define BENCH_WIDTH 240
+#define BENCH_HEIGHT 80
+#define BENCH_LARGE_WIDTH 640
+#define BENCH_LARGE_HEIGHT 200
+
+typedef void (*BenchFunc)(u32 iteration);
+
+#define BENCH_PANELS 6
+
+global_variable TermCanvas g_bench_panels[BENCH_PANELS];
+global_variable TermCanvas g_bench_canvas;
+global_variable TermCanvas g_bench_popup;
+global_variable u32        g_bench_pixels[BENCH_WIDTH * BENCH_HEIGHT * 2];
+
+internal u32 bench_colour(u32 iteration)
+{
+    return term_rgb((u8)(iteration * 37), (u8)(iteration * 91), 128);
+}
+
+internal void bench_cls(u32 iteration)
+{
+    term_fb_cls(bench_colour(iteration), bench_colour(iteration + 1));
+}
+
+internal void bench_rect(u32 iteration)
+{
+    TermRect rect = {(u16)random_range_u64(0, BENCH_WIDTH - 40),
+                     (u16)random_range_u64(0, BENCH_HEIGHT - 12),
+                     40,
+                     12};
+    term_fb_rect(
+        rect, 'a' + iteration % 26, bench_colour(iteration), term_rgb(0, 0, 0));
+}
+
+internal void bench_rect_colour(u32 iteration)
+{
+    TermRect rect = {(u16)random_range_u64(0, BENCH_WIDTH - 40),
+                     (u16)random_range_u64(0, BENCH_HEIGHT - 12),
+                     40,
+                     12};
+    term_fb_rect_colour(rect, bench_colour(iteration), term_rgb(0, 0, 0));
+}
+
+internal void bench_rect_blend(u32 iteration)
+{
+    TermRect rect = {(u16)random_range_u64(0, BENCH_WIDTH - 40),
+                     (u16)random_range_u64(0, BENCH_HEIGHT - 12),
+                     40,
+                     12};
+    term_fb_rect_blend(rect, term_rgba(255, 255, 255, (u8)iteration));
+}
+
+internal void bench_write(u32 iteration)
+{
+    // A typical log line filling most of a row.
+    term_fb_write(0,
+                  (u16)(iteration % BENCH_HEIGHT),
+                  "2025-06-01 12:34:56.789 INFO  [worker-3] request completed "
+                  "in 12ms: GET /api/v1/status?verbose=1 -> 200 OK (512 bytes "
+                  "sent, keep-alive, cache miss) trace=6f1c2a9e4b7d3580");
+}
+
+internal void bench_present_full(u32 iteration)
+{
+    bench_cls(iteration);
+    term_fb_present();
+}
+
+internal void bench_present_sparse(u32 iteration)
+{
+    // Roughly 2% of the cells change each frame, as in a typical dashboard.
+    for (u32 i = 0; i < BENCH_WIDTH * BENCH_HEIGHT / 50; ++i) {
+        TermRect rect = {(u16)random_range_u64(0, BENCH_WIDTH - 1),
+                         (u16)random_range_u64(0, BENCH_HEIGHT - 1),
+                         1,
+                         1};
+        term_fb_rect(rect, 'a' + i % 26, bench_colour(iteration + i), 0);
+    }
+    term_fb_present();
+}
+
+internal void bench_present_scroll(u32 iteration)
+{
+    // A tail-style log view below a status line: everything moves up a row
+    // and a new line appears at the bottom.
+    TermRect log = {0, 1, BENCH_WIDTH, BENCH_HEIGHT - 1};
+    if (iteration == 0) {
+        term_fb_cls(term_rgb(200, 200, 200), term_rgb(0, 0, 0));
+    }
+    term_fb_scroll(log, 1);
+    term_fb_format(0,
+                   BENCH_HEIGHT - 1,
+                   "%08x INFO  request %u completed in %ums",
+                   iteration * 2654435761u,
+                   iteration,
+                   iteration % 97);
+    term_fb_present();
+}
+
+internal void bench_present_dashboard(u32 iteration)
+{
+    // A bordered dashboard with a title bar, repainted in new colours.
+    u32 ink   = bench_colour(iteration);
+    u32 paper = bench_colour(iteration + 1);
+    term_fb_cls(ink, paper);
+    term_fb_rect((TermRect){0, 0, BENCH_WIDTH, 1}, ' ', paper, ink);
+    term_fb_write(2, 0, "Dashboard");
+    for (u16 y = 1; y < BENCH_HEIGHT; y += BENCH_HEIGHT / 4 - 1) {
+        term_fb_rect_char((TermRect){0, y, BENCH_WIDTH, 1}, 0x2500);
+    }
+    for (u16 x = 0; x < BENCH_WIDTH; x += BENCH_WIDTH / 3 - 1) {
+        term_fb_rect_char((TermRect){x, 1, 1, BENCH_HEIGHT - 1}, 0x2502);
+    }
+    term_fb_present();
+}
+
+internal void bench_init_panels(Arena* arena)
+{
+    u16 width  = BENCH_WIDTH / 3;
+    u16 height = BENCH_HEIGHT / 2;
+    for (u32 i = 0; i < BENCH_PANELS; ++i) {
+        TermCanvas* panel = &g_bench_panels[i];
+        term_canvas_init(panel, arena, width, height);
+        term_canvas_cls(panel, bench_colour(i), bench_colour(i + 1));
+        term_canvas_rect(panel, (TermRect){0, 0, width, 1}, ' ', 0, 0);
+        term_canvas_format(panel, 1, 0, "Panel %u", i);
+        for (u16 y = 1; y < height; ++y) {
+            term_canvas_format(panel, 1, y, "%u: %u", y, y * 2654435761u);
+        }
+    }
+}
+
+internal void bench_present_panels(u32 iteration)
+{
+    // Retained panels composited every frame, with one line of one panel
+    // changing.
+    TermCanvas* changed = &g_bench_panels[iteration % BENCH_PANELS];
+    term_canvas_format(changed, 1, 1, "frame %8u", iteration);
+    for (u32 i = 0; i < BENCH_PANELS; ++i) {
+        TermCanvas* panel = &g_bench_panels[i];
+        term_fb_blit(panel,
+                     (TermRect){0, 0, panel->width, panel->height},
+                     (u16)(i % 3 * panel->width),
+                     (u16)(i / 3 * panel->height));
+    }
+    term_fb_present();
+}
+
+internal void bench_present_heatmap(u32 iteration)
+{
+    // A full screen heatmap at twice the vertical resolution, in bands of
+    // colour that move each frame.
+    for (u32 y = 0; y < BENCH_HEIGHT * 2; ++y) {
+        for (u32 x = 0; x < BENCH_WIDTH; ++x) {
+            g_bench_pixels[y * BENCH_WIDTH + x] =
+                bench_colour((x / 8 + y / 4 + iteration) / 4);
+        }
+    }
+    TermPixels image = {.pixels = g_bench_pixels,
+                        .width  = BENCH_WIDTH,
+                        .height = BENCH_HEIGHT * 2};
+    TermRect   rect  = {0, 0, BENCH_WIDTH, BENCH_HEIGHT};
+    term_canvas_half_blocks(&g_bench_canvas, 0, 0, image);
+    term_fb_blit(&g_bench_canvas, rect, 0, 0);
+    term_fb_present();
+}
+
+internal void bench_init_popup(Arena* arena)
+{
+    u16 width  = BENCH_WIDTH / 2;
+    u16 height = BENCH_HEIGHT / 2;
+    term_canvas_init(&g_bench_popup, arena, width, height);
+    term_canvas_rect(&g_bench_popup,
+                     (TermRect){2, 1, width - 4, height - 2},
+                     ' ',
+                     term_rgb(255, 255, 255),
+                     term_rgba(40, 40, 120, 200));
+    term_canvas_write(&g_bench_popup, 4, 2, "Really quit? (y/n)");
+}
+
+internal void bench_present_popup(u32 iteration)
+{
+    // A modal popup fading in: the screen behind it is redrawn, dimmed, and
+    // the popup blended over it.
+    u8 fade = (u8)(iteration % 32 * 8);
+    term_fb_cls(term_rgb(200, 200, 200), term_rgb(0, 60, 0));
+    term_fb_write(0, 0, "Dashboard");
+    term_fb_blend_paper((TermRect){0, 0, BENCH_WIDTH, BENCH_HEIGHT},
+                        term_rgba(0, 0, 0, fade / 2));
+    term_fb_blit_blend(
+        &g_bench_popup,
+        (TermRect){0, 0, g_bench_popup.width, g_bench_popup.height},
+        BENCH_WIDTH / 4,
+        BENCH_HEIGHT / 4);
+    term_fb_present();
+}
+
+internal void bench_run(cstr name, BenchFunc func, u32 iterations)
+{
+    // Warm up the caches and the colour palette first.
+    for (u32 i = 0; i < iterations / 10; ++i) {
+        func(i);
+    }
+    term_headless_clear_output();
+
+    u64       bytes = g_term_stats.total_bytes;
+    TimePoint start = time_now();
+    for (u32 i = 0; i < iterations; ++i) {
+        func(i);
+    }
+    TimeDuration elapsed = time_elapsed(start, time_now());
+
+    bytes                = g_term_stats.total_bytes - bytes;
+    term_headless_clear_output();
+
+    eprn("  %-20s %10.3f us %10.1f bytes",
+         name,
+         time_secs(elapsed) * 1e6 / iterations,
+         (f64)bytes / iterations);
+}
+
+int kmain(int argc, char** argv)
+{
+    KORE_UNUSED(argc);
+    KORE_UNUSED(argv);
+
+    random_seed(1);
+    term_init(.headless_size = {BENCH_WIDTH, BENCH_HEIGHT});
+
+    // The headless terminal supports REP, but it is measured separately.
+    g_term.rep = false;
+
+    eprn("Framebuffer %dx%d, %s layout",
+         BENCH_WIDTH,
+         BENCH_HEIGHT,
+         TERM_FB_INTERLEAVED ? "interleaved" : "planar");
+    bench_run("cls", bench_cls, 20000);
+    bench_run("rect 40x12", bench_rect, 100000);
+    bench_run("rect_colour 40x12", bench_rect_colour, 100000);
+    bench_run("rect_blend 40x12", bench_rect_blend, 100000);
+    bench_run("write 190 chars", bench_write, 100000);
+    bench_run("present full", bench_present_full, 500);
+    bench_run("present sparse", bench_present_sparse, 5000);
+    bench_run("present scroll", bench_present_scroll, 5000);
+    bench_run("present dashboard", bench_present_dashboard, 500);
+    g_term.rep = true;
+    bench_run("  with REP", bench_present_dashboard, 500);
+    g_term.rep = false;
+
+    Arena panel_arena;
+    arena_init(&panel_arena);
+    bench_init_panels(&panel_arena);
+    bench_run("present panels", bench_present_panels, 5000);
+    term_canvas_init(&g_bench_canvas, &panel_arena, BENCH_WIDTH, BENCH_HEIGHT);
+    bench_run("present heatmap", bench_present_heatmap, 500);
+    bench_init_popup(&panel_arena);
+    bench_run("present popup", bench_present_popup, 500);
+    arena_done(&panel_arena);
+
+    // A 4K screen with a small font, encoded on one thread and then on as
+    // many as there are processors.
+    term_headless_resize((TermSize){BENCH_LARGE_WIDTH, BENCH_LARGE_HEIGHT});
+    eprn("Framebuffer %dx%d, %zu processors",
+         BENCH_LARGE_WIDTH,
+         BENCH_LARGE_HEIGHT,
+         cpu_count());
+    g_term.present_threads = 1;
+    bench_run("present full", bench_present_full, 100);
+    g_term.present_threads = 0;
+    bench_run("  in parallel", bench_present_full, 100);
+
+    // Frames handed to a writer thread.  Any that are dropped because the
+    // writer is still busy cost almost nothing and send nothing.
+    _term_writer_start();
+    bench_run("  threaded output", bench_present_full, 100);
+    _term_writer_stop();
+    eprn("  %-20s %10llu",
+         "dropped frames",
+         (unsigned long long)g_term_stats.dropped_frames);
+
+    usize mismatches = term_headless_verify();
+    eprn("Screen check: %zu cells differ", mismatches);
+
+    term_done();
+    term_loop();
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+//------------------------------------------------------------------------------
+// Terminal broadcast client
+//
+// Shows the frames of a program that was started with
+// TermInitParams.broadcast_path set, by copying them from its socket to this
+// terminal:
+//
+//      ./build.sh -r termcast && ./_bin/termcast /tmp/dashboard.sock
+//
+// The terminal should be at least as large as the broadcasting one.  Press
+// Ctrl-C to stop watching.
+//------------------------------------------------------------------------------
+
+#define KORE_IMPLEMENTATION
+#include <errno.h>
+#include <kore/kore.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+global_variable volatile sig_atomic_t g_cast_quit = 0;
+
+internal void cast_on_signal(int sig)
+{
+    KORE_UNUSED(sig);
+    g_cast_quit = 1;
+}
+
+internal bool cast_write(const void* data, usize size)
+{
+    const u8* bytes = (const u8*)data;
+    while (size > 0) {
+        ssize_t written = write(STDOUT_FILENO, bytes, size);
+        if (written > 0) {
+            bytes += written;
+            size -= (usize)written;
+        } else if (written < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#define cast_write_literal(str) cast_write((str), sizeof(str) - 1)
+
+int kmain(int argc, char** argv)
+{
+    if (argc != 2) {
+        eprn("Usage: termcast <socket path>");
+        return 1;
+    }
+
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(argv[1]) >= sizeof(address.sun_path)) {
+        eprn("Socket path is too long: %s", argv[1]);
+        return 1;
+    }
+    strcpy(address.sun_path, argv[1]);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        eprn("Cannot connect to %s: %s", argv[1], strerror(errno));
+        return 1;
+    }
+
+    // Keys typed while watching are not echoed over the picture.  Ctrl-C
+    // interrupts the read below rather than killing us, so the terminal is
+    // always put back.
+    struct termios original;
+    bool           have_tios = tcgetattr(STDIN_FILENO, &original) == 0;
+    if (have_tios) {
+        struct termios quiet = original;
+        quiet.c_lflag &= ~(ECHO | ICANON);
+        tcsetattr(STDIN_FILENO, TCSANOW, &quiet);
+    }
+    struct sigaction action = {.sa_handler = cast_on_signal};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    cast_write_literal("\x1b[?1049h\x1b[?25l");
+    while (!g_cast_quit) {
+        u8      buffer[65536];
+        ssize_t bytes = read(fd, buffer, sizeof(buffer));
+        if (bytes > 0) {
+            if (!cast_write(buffer, (usize)bytes)) {
+                break;
+            }
+        } else if (bytes == 0 || errno != EINTR) {
+            // The broadcasting program has finished.
+            break;
+        }
+    }
+
+    // CAN abandons any escape sequence cut short by Ctrl-C.
+    cast_write_literal("\x18\x1b[0m\x1b[?25h\x1b[?1049l");
+    if (have_tios) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &original);
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,152 @@
+//------------------------------------------------------------------------------
+// Terminal recording player
+//
+// Plays back a recording made by a program that was started with
+// TermInitParams.record_path set:
+//
+//      ./build.sh -r termreplay && ./_bin/termreplay /tmp/dashboard.rec
+//
+// Options:
+//
+//      -s <seconds>    Start this far into the recording, from the keyframe
+//                      at or before it.
+//      -f              Play as fast as possible and report the throughput,
+//                      which measures how quickly this terminal draws.
+//
+// The terminal should be at least as large as the recorded one.  Press Ctrl-C
+// to stop.
+//------------------------------------------------------------------------------
+
+#define KORE_IMPLEMENTATION
+#include <kore/kore.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <term/term.h>
+
+global_variable volatile sig_atomic_t g_replay_quit = 0;
+
+internal void replay_on_signal(int sig)
+{
+    KORE_UNUSED(sig);
+    g_replay_quit = 1;
+}
+
+// Reads a whole file into memory, which is freed with KORE_FREE.
+internal bool replay_load(cstr path, string* out_data)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    u8* data = size > 0 ? KORE_ALLOC((usize)size) : NULL;
+    bool ok  = size >= 0 &&
+              (size == 0 || fread(data, 1, (usize)size, file) == (usize)size);
+    fclose(file);
+    if (!ok) {
+        KORE_FREE(data);
+        return false;
+    }
+    *out_data = string_from(data, (usize)size);
+    return true;
+}
+
+internal void replay_write(string output)
+{
+    fwrite(output.data, 1, output.count, stdout);
+    fflush(stdout);
+}
+
+int kmain(int argc, char** argv)
+{
+    bool fast     = false;
+    u64  start_us = 0;
+    cstr path     = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-f") == 0) {
+            fast = true;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            start_us = (u64)(atof(argv[++i]) * 1e6);
+        } else if (!path && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (!path) {
+        eprn("Usage: termreplay [-f] [-s <seconds>] <recording>");
+        return 1;
+    }
+
+    string           data;
+    TermRecordReader reader;
+    if (!replay_load(path, &data)) {
+        eprn("Cannot read %s", path);
+        return 1;
+    }
+    if (!term_record_reader_init(&reader, data)) {
+        eprn("%s is not a recording", path);
+        KORE_FREE(data.data);
+        return 1;
+    }
+
+    // Playback starts from the last keyframe at or before the start time, or
+    // from the beginning if there is none.
+    TermRecord keyframe = {0};
+    TermRecord record;
+    for (TermRecordReader scan = reader; term_record_next(&scan, &record);) {
+        if (record.time_us > start_us) {
+            break;
+        }
+        if (record.kind == TERM_RECORD_KEYFRAME) {
+            keyframe = record;
+            reader   = scan;
+        }
+    }
+
+    signal(SIGINT, replay_on_signal);
+    signal(SIGTERM, replay_on_signal);
+    fputs("\x1b[?1049h\x1b[?25l", stdout);
+    if (keyframe.kind == TERM_RECORD_KEYFRAME) {
+        replay_write(keyframe.output);
+    }
+
+    // Frames are sent when they are due, relative to where playback started.
+    // Later keyframes only repeat what the frames before them drew.
+    u64       frames = 0;
+    u64       bytes  = 0;
+    TimePoint began  = time_now();
+    while (!g_replay_quit && term_record_next(&reader, &record)) {
+        if (record.kind == TERM_RECORD_KEYFRAME) {
+            continue;
+        }
+        if (!fast) {
+            u64 due_us = record.time_us - keyframe.time_us;
+            u64 now_us = time_duration_to_us(time_elapsed(began, time_now()));
+            if (due_us > now_us) {
+                time_sleep_ms((u32)((due_us - now_us) / 1000));
+            }
+        }
+        replay_write(record.output);
+        frames += 1;
+        bytes += record.output.count;
+    }
+    f64 secs = time_secs(time_elapsed(began, time_now()));
+
+    // CAN abandons any escape sequence cut short by Ctrl-C.
+    fputs("\x18\x1b[0m\x1b[?25h\x1b[?1049l", stdout);
+    fflush(stdout);
+    if (fast && secs > 0.0) {
+        eprn("%llu frames, %.1f MB in %.3f s: %.1f frames/s, %.1f MB/s",
+             (unsigned long long)frames,
+             bytes / 1e6,
+             secs,
+             frames / secs,
+             bytes / 1e6 / secs);
+    }
+    KORE_FREE(data.data);
+    return 0;
+}
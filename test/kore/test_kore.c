@@ -980,6 +980,108 @@ TEST_CASE(arena_session, alloc_and_undo)
     arena_done(&arena);
 }
 
+TEST_CASE(bits, ctz)
+{
+    TEST_ASSERT_EQ(bits_ctz_u64(1), 0);
+    TEST_ASSERT_EQ(bits_ctz_u64(0x8), 3);
+    TEST_ASSERT_EQ(bits_ctz_u64(0x8000000000000000ull), 63);
+    TEST_ASSERT_EQ(bits_ctz_u64(0xFFFF0000ull), 16);
+}
+
+TEST_CASE(bits, popcount)
+{
+    TEST_ASSERT_EQ(bits_popcount_u64(0), 0);
+    TEST_ASSERT_EQ(bits_popcount_u64(0xF0F0), 8);
+    TEST_ASSERT_EQ(bits_popcount_u64(~0ull), 64);
+    TEST_ASSERT_EQ(bits_popcount_u64(0x8000000000000001ull), 2);
+}
+
+// A value handed back and forth between two threads.
+typedef struct {
+    Mutex   mutex;
+    CondVar changed;
+    u32     value;
+} ThreadBall;
+
+internal void thread_ball_return(void* data)
+{
+    ThreadBall* ball = (ThreadBall*)data;
+    mutex_lock(&ball->mutex);
+    for (u32 i = 0; i < 100; ++i) {
+        // Wait for an odd value and make it even.
+        while (ball->value % 2 == 0) {
+            cond_wait(&ball->changed, &ball->mutex);
+        }
+        ball->value += 1;
+        cond_signal(&ball->changed);
+    }
+    mutex_unlock(&ball->mutex);
+}
+
+TEST_CASE(thread, start_and_join)
+{
+    ThreadBall ball = {0};
+    mutex_init(&ball.mutex);
+    cond_init(&ball.changed);
+
+    Thread thread;
+    TEST_ASSERT(thread_start(&thread, thread_ball_return, &ball));
+    mutex_lock(&ball.mutex);
+    for (u32 i = 0; i < 100; ++i) {
+        ball.value += 1;
+        cond_signal(&ball.changed);
+        while (ball.value % 2 != 0) {
+            cond_wait(&ball.changed, &ball.mutex);
+        }
+    }
+    mutex_unlock(&ball.mutex);
+    thread_join(&thread);
+
+    TEST_ASSERT_EQ(ball.value, 200);
+    TEST_ASSERT(cpu_count() >= 1);
+
+    cond_done(&ball.changed);
+    mutex_done(&ball.mutex);
+}
+
+internal void thread_pool_count_job(void* data, usize index)
+{
+    u32* counts = (u32*)data;
+    counts[index] += 1;
+}
+
+TEST_CASE(thread_pool, runs_every_job_once)
+{
+    ThreadPool pool;
+    thread_pool_init(&pool, 3);
+    TEST_ASSERT_EQ(pool.thread_count, 3);
+
+    u32 counts[1000] = {0};
+    for (int batch = 0; batch < 20; ++batch) {
+        thread_pool_run(&pool, thread_pool_count_job, counts, 1000);
+    }
+    for (usize i = 0; i < 1000; ++i) {
+        TEST_ASSERT_EQ(counts[i], 20);
+    }
+
+    thread_pool_done(&pool);
+}
+
+TEST_CASE(thread_pool, without_threads)
+{
+    ThreadPool pool;
+    thread_pool_init(&pool, 0);
+
+    u32 counts[10] = {0};
+    thread_pool_run(&pool, thread_pool_count_job, counts, 10);
+    thread_pool_run(&pool, thread_pool_count_job, counts, 0);
+    for (usize i = 0; i < 10; ++i) {
+        TEST_ASSERT_EQ(counts[i], 1);
+    }
+
+    thread_pool_done(&pool);
+}
+
 TEST_CASE(time, conversions)
 {
     TimeDuration one_second = time_from_secs(1);
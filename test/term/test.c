@@ -0,0 +1,8 @@
+#define TEST_IMPLEMENTATION
+
+#include <kore/kore.h>
+#include <test/test.h>
+
+TEST_SUITE_BEGIN()
+RUN_ALL_TESTS();
+TEST_SUITE_END()
@@ -0,0 +1,1385 @@
+// The implementation is compiled here rather than in test.c, so that the
+// tests can reach the terminal's internals, such as the input decoder.
+#define KORE_TEST 1
+#define KORE_IMPLEMENTATION
+
+#include <kore/kore.h>
+#include <term/term.h>
+#include <test/test.h>
+
+#if KORE_OS_POSIX
+#    include <fcntl.h>
+#    include <sys/socket.h>
+#    include <sys/un.h>
+#    include <unistd.h>
+#endif
+
+//------------------------------------------------------------------------------
+// Headless terminal
+
+internal void term_test_stop(void)
+{
+    term_done();
+    TEST_ASSERT(!term_loop());
+}
+
+internal u32 term_test_colour(void)
+{
+    return term_rgb((u8)random_range_u64(0, 255),
+                    (u8)random_range_u64(0, 255),
+                    (u8)random_range_u64(0, 255));
+}
+
+// Draws a random mixture of rectangles, text and scrolls.
+internal void term_test_draw(TermSize size)
+{
+    static cstr words[] = {"hello", "wörld", "日本語", "box ─┼─", "a", "x\ty"};
+    const usize word_count = sizeof(words) / sizeof(words[0]);
+
+    u32 ops = (u32)random_range_u64(0, 20);
+    for (u32 i = 0; i < ops; ++i) {
+        TermRect rect = {(u16)random_range_u64(0, size.width - 1),
+                         (u16)random_range_u64(0, size.height - 1),
+                         (u16)random_range_u64(1, size.width / 2),
+                         (u16)random_range_u64(1, size.height / 2)};
+        switch (random_range_u64(0, 4)) {
+        case 0:
+            term_fb_rect(rect,
+                         "ab#-"[random_range_u64(0, 3)],
+                         term_test_colour(),
+                         term_test_colour());
+            break;
+        case 1: term_fb_rect_colour(rect, term_test_colour(), 0); break;
+        case 2: term_fb_rect_paper(rect, term_test_colour()); break;
+        case 3:
+            term_fb_write(rect.x,
+                          rect.y,
+                          words[random_range_u64(0, word_count - 1)]);
+            break;
+        case 4:
+            if (random_range_u64(0, 1)) {
+                rect.x     = 0;
+                rect.width = size.width;
+            }
+            term_fb_scroll(rect, (int)random_range_u64(0, 6) - 3);
+            break;
+        }
+    }
+}
+
+TEST_CASE(headless, starts_at_its_size)
+{
+    term_init(.headless_size = {40, 10});
+    TermSize size = term_size_get();
+    TEST_ASSERT_EQ(size.width, 40);
+    TEST_ASSERT_EQ(size.height, 10);
+
+    TermEvent event = term_poll_event();
+    TEST_ASSERT_EQ(event.kind, TERM_EVENT_RESIZE);
+    TEST_ASSERT_EQ(event.size.width, 40);
+    TEST_ASSERT_EQ(event.size.height, 10);
+    TEST_ASSERT(!term_wait(0));
+
+    term_headless_resize((TermSize){20, 5});
+    event = term_poll_event();
+    TEST_ASSERT_EQ(event.kind, TERM_EVENT_RESIZE);
+    TEST_ASSERT_EQ(term_size_get().width, 20);
+
+    term_test_stop();
+}
+
+TEST_CASE(headless, captures_output)
+{
+    term_init(.headless_size = {20, 4});
+    term_headless_clear_output();
+
+    term_fb_cls(term_rgb(255, 255, 255), term_rgb(0, 0, 0));
+    term_fb_write(2, 1, "Hi");
+    term_fb_present();
+    string output = term_headless_output();
+    TEST_ASSERT_EQ(output.count, term_stats().frame_bytes);
+
+    TermHeadlessCell cell = term_headless_cell(3, 1);
+    TEST_ASSERT_EQ(cell.ch, 'i');
+    TEST_ASSERT_EQ(cell.ink, 0xFFFFFF);
+    TEST_ASSERT_EQ(cell.paper, 0);
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+
+    // Nothing changed, so nothing is sent.
+    term_headless_clear_output();
+    term_fb_present();
+    TEST_ASSERT_EQ(term_headless_output().count, 0);
+
+    term_test_stop();
+}
+
+TEST_CASE(headless, verify_finds_differences)
+{
+    term_init(.headless_size = {20, 4});
+    term_fb_cls(term_rgb(255, 255, 255), 0);
+    term_fb_present();
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+
+    term_fb_write(0, 0, "abc");
+    TEST_ASSERT_EQ(term_headless_verify(), 3);
+
+    term_test_stop();
+}
+
+// Counts the cells of the headless screen that hold a character.
+internal u32 term_test_count_chars(u32 ch)
+{
+    TermSize size  = term_size_get();
+    u32      count = 0;
+    for (u16 y = 0; y < size.height; ++y) {
+        for (u16 x = 0; x < size.width; ++x) {
+            count += term_headless_cell(x, y).ch == ch;
+        }
+    }
+    return count;
+}
+
+TEST_CASE(headless, rects_are_clipped)
+{
+    term_init(.headless_size = {40, 10});
+    term_fb_cls(term_rgb(255, 255, 255), 0);
+
+    // Rectangles wholly off the screen, including ones whose far edges would
+    // wrap around in 16 bits, leave it alone.
+    u32 ink = term_rgb(255, 0, 0);
+    term_fb_rect((TermRect){60, 2, 5, 2}, 'x', ink, 0);
+    term_fb_rect((TermRect){2, 10, 5, 2}, 'x', ink, 0);
+    term_fb_rect((TermRect){65530, 65530, 10, 10}, 'x', ink, 0);
+    term_fb_rect_colour((TermRect){40, 0, 65535, 65535}, ink, ink);
+    term_fb_present();
+    TEST_ASSERT_EQ(term_test_count_chars(' '), 400);
+    TEST_ASSERT_EQ(term_headless_cell(39, 9).paper, 0);
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+
+    // Those straddling the edges are cut short.
+    term_fb_rect((TermRect){37, 8, 10, 10}, 'x', ink, 0);
+    term_fb_rect((TermRect){0, 9, 65535, 65535}, 'y', ink, 0);
+    term_fb_present();
+    TEST_ASSERT_EQ(term_test_count_chars('x'), 3);
+    TEST_ASSERT_EQ(term_test_count_chars('y'), 40);
+    TEST_ASSERT_EQ(term_headless_cell(37, 8).ch, 'x');
+    TEST_ASSERT_EQ(term_headless_cell(36, 8).ch, ' ');
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+
+    term_test_stop();
+}
+
+TEST_CASE(headless, scrolls_are_clipped)
+{
+    term_init(.headless_size = {40, 10});
+    term_fb_cls(term_rgb(255, 255, 255), 0);
+    for (u16 y = 0; y < 10; ++y) {
+        term_fb_format(0, y, "row %u", y);
+    }
+    term_fb_present();
+
+    // Regions wholly off the screen do nothing.
+    term_fb_scroll((TermRect){60, 0, 5, 5}, 1);
+    term_fb_scroll((TermRect){0, 10, 40, 5}, -1);
+    term_fb_scroll((TermRect){65530, 65530, 10, 10}, 2);
+    term_fb_present();
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+    for (u16 y = 0; y < 10; ++y) {
+        TEST_ASSERT_EQ(term_headless_cell(4, y).ch, '0' + y);
+    }
+
+    // Full rows straddling the bottom, scrolled by the terminal.
+    term_fb_scroll((TermRect){0, 6, 65535, 65535}, 2);
+    term_fb_present();
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+    TEST_ASSERT_EQ(term_headless_cell(4, 5).ch, '5');
+    TEST_ASSERT_EQ(term_headless_cell(4, 6).ch, '8');
+    TEST_ASSERT_EQ(term_headless_cell(4, 7).ch, '9');
+    TEST_ASSERT_EQ(term_headless_cell(0, 8).ch, ' ');
+    TEST_ASSERT_EQ(term_headless_cell(0, 9).ch, ' ');
+
+    // Part rows straddling the right edge, which are redrawn.
+    term_fb_scroll((TermRect){2, 0, 100, 3}, -1);
+    term_fb_present();
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+    TEST_ASSERT_EQ(term_headless_cell(0, 0).ch, 'r');
+    TEST_ASSERT_EQ(term_headless_cell(2, 0).ch, ' ');
+    TEST_ASSERT_EQ(term_headless_cell(4, 1).ch, '0');
+    TEST_ASSERT_EQ(term_headless_cell(4, 2).ch, '1');
+    TEST_ASSERT_EQ(term_headless_cell(4, 3).ch, '3');
+
+    term_test_stop();
+}
+
+// Fills `text` with `count` letters, starting from the `first`th.
+internal void term_test_letters(char* text, usize first, usize count)
+{
+    for (usize i = 0; i < count; ++i) {
+        text[i] = (char)('A' + (first + i) % 26);
+    }
+}
+
+TEST_CASE(headless, writes_long_runs)
+{
+    term_init(.headless_size = {60, 20});
+    term_fb_cls(term_rgb(255, 255, 255), 0);
+
+    // Runs longer than 32 bytes, with a multibyte character at and just after
+    // each step of the 16 and 32 byte searches for the end of the run.  The
+    // text is not terminated, so nothing past its length may be written.
+    static const usize offsets[] = {15, 16, 17, 31, 32, 33, 47};
+    static const cstr  inserts[] = {"é", "日"};
+    static const u32   chars[]   = {0xE9, 0x65E5};
+    u16                y         = 0;
+    for (usize i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i) {
+        for (usize j = 0; j < 2; ++j, ++y) {
+            char  text[64];
+            usize offset = offsets[i];
+            usize bytes  = strlen(inserts[j]);
+            memset(text, '!', sizeof(text));
+            term_test_letters(text, 0, offset);
+            memcpy(text + offset, inserts[j], bytes);
+            term_test_letters(text + offset + bytes, offset, 48 - offset);
+            term_fb_write_string(0, y, string_from((u8*)text, 48 + bytes));
+        }
+    }
+
+    // Text reaching the right edge wraps back to where it started, and text
+    // starting past the edge is dropped.
+    char text[40];
+    term_test_letters(text, 0, 25);
+    term_fb_write_string(50, 14, string_from((u8*)text, 25));
+    term_test_letters(text, 0, 40);
+    term_fb_write_string(60, 18, string_from((u8*)text, 40));
+    term_fb_write(65535, 18, "abc");
+    term_fb_write(0, 20, "abc");
+    term_fb_present();
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+
+    y = 0;
+    for (usize i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i) {
+        for (usize j = 0; j < 2; ++j, ++y) {
+            usize offset = offsets[i];
+            u16   width  = (u16)(j + 1);
+            for (u16 x = 0; x < 60; ++x) {
+                u32 ch = term_headless_cell(x, y).ch;
+                if (x < offset) {
+                    TEST_ASSERT_EQ(ch, 'A' + x % 26);
+                } else if (x == offset) {
+                    TEST_ASSERT_EQ(ch, chars[j]);
+                } else if (x >= offset + width && x < 48 + width) {
+                    TEST_ASSERT_EQ(ch, 'A' + (x - width) % 26);
+                } else if (x >= 48 + width) {
+                    TEST_ASSERT_EQ(ch, ' ');
+                }
+            }
+        }
+    }
+    for (u16 x = 0; x < 60; ++x) {
+        bool wrapped = x >= 50;
+        TEST_ASSERT_EQ(term_headless_cell(x, 14).ch,
+                       wrapped ? 'A' + (x - 50) : ' ');
+        TEST_ASSERT_EQ(term_headless_cell(x, 15).ch,
+                       wrapped ? 'A' + (x - 40) : ' ');
+        TEST_ASSERT_EQ(term_headless_cell(x, 16).ch,
+                       x >= 50 && x < 55 ? 'A' + (x - 30) : ' ');
+        TEST_ASSERT_EQ(term_headless_cell(x, 18).ch, ' ');
+    }
+
+    term_test_stop();
+}
+
+TEST_CASE(headless, moving_down_keeps_wide_characters)
+{
+    term_init(.headless_size = {40, 20});
+    term_fb_cls(term_rgb(255, 255, 255), 0);
+    term_fb_write(13, 11, "日cd");
+    term_fb_present();
+
+    // After the Z, moving down puts the cursor on the tail of 日, so the
+    // cells up to the q must not be reprinted from there.
+    term_fb_write(13, 10, "Z");
+    term_fb_write(17, 11, "q");
+    term_fb_present();
+    TEST_ASSERT_EQ(term_headless_cell(13, 11).ch, 0x65E5);
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+
+    term_test_stop();
+}
+
+// Checks that each row still starts with its label and colour.
+internal void term_test_check_rows(u16 rows)
+{
+    for (u16 y = 0; y < rows; ++y) {
+        char label[16];
+        snprintf(label, sizeof(label), "row %u", y);
+        for (u16 x = 0; label[x]; ++x) {
+            TermHeadlessCell cell = term_headless_cell(x, y);
+            TEST_ASSERT_EQ(cell.ch, (u32)label[x]);
+            TEST_ASSERT_EQ(cell.paper, 0x010000u * (y + 1) * 20);
+        }
+    }
+}
+
+TEST_CASE(headless, resizing_keeps_the_screen)
+{
+    term_init(.headless_size = {40, 8});
+    for (u16 y = 0; y < 8; ++y) {
+        term_fb_rect_colour((TermRect){0, y, 40, 1},
+                            term_rgb(255, 255, 255),
+                            term_rgb((u8)((y + 1) * 20), 0, 0));
+        term_fb_format(0, y, "row %u", y);
+    }
+    term_fb_present();
+    term_test_check_rows(8);
+
+    // Narrower, then wider within the same memory so that rows move up to
+    // make room, then wider and taller still.
+    static const TermSize sizes[] = {{20, 8}, {30, 9}, {50, 12}};
+    for (usize i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        term_headless_resize(sizes[i]);
+        term_fb_present();
+        TEST_ASSERT_EQ(term_headless_verify(), 0);
+        term_test_check_rows(8);
+        TEST_ASSERT_EQ(term_headless_cell(sizes[i].width - 1, 0).ch, ' ');
+    }
+
+    term_headless_resize((TermSize){4, 6});
+    term_fb_present();
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+    for (u16 y = 0; y < 6; ++y) {
+        TEST_ASSERT_EQ(term_headless_cell(0, y).ch, 'r');
+        TEST_ASSERT_EQ(term_headless_cell(3, y).ch, ' ');
+    }
+
+    term_test_stop();
+}
+
+TEST_CASE(headless, presents_random_frames)
+{
+    static const TermColourMode modes[] = {
+        TERM_COLOUR_TRUE, TERM_COLOUR_256, TERM_COLOUR_16};
+
+    random_seed(1);
+    for (usize m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        term_init(.colour_mode = modes[m], .headless_size = {73, 21});
+        TermSize size = term_size_get();
+        for (int frame = 0; frame < 50; ++frame) {
+            if (frame % 10 == 0) {
+                term_fb_cls(term_test_colour(), term_test_colour());
+            }
+            term_test_draw(size);
+            term_fb_present();
+            TEST_ASSERT_EQ(term_headless_verify(), 0);
+            term_headless_clear_output();
+        }
+        term_test_stop();
+    }
+}
+
+TEST_CASE(headless, presents_on_the_writer_thread)
+{
+    random_seed(2);
+    term_init(.headless_size = {320, 120},
+              .present_threads = 4,
+              .threaded_output = true);
+    TermSize size = term_size_get();
+    for (int frame = 0; frame < 20; ++frame) {
+        term_fb_cls(term_test_colour(), term_test_colour());
+        term_test_draw(size);
+        term_fb_present();
+
+        // Waiting for the writer means no frame is dropped.
+        TEST_ASSERT_EQ(term_headless_verify(), 0);
+    }
+    TEST_ASSERT_EQ(term_stats().dropped_frames, 0);
+    term_test_stop();
+}
+
+//------------------------------------------------------------------------------
+// Framebuffer
+//
+// The framebuffer is resized directly, without starting the terminal.
+
+internal u32 term_test_row_paper(u16 y)
+{
+    return term_rgb((u8)((y + 1) * 20), 0, 0);
+}
+
+// Checks that each of the first `rows` rows still starts with its label and
+// colour, that the rest of the framebuffer is blank, and that every cell is
+// dirty.
+internal void term_test_check_fb(u16 rows, u16 label_width)
+{
+    TermSize size = g_term_fb_size;
+    for (u16 y = 0; y < size.height; ++y) {
+        char label[16];
+        snprintf(label, sizeof(label), "row %u", y);
+        for (u16 x = 0; x < size.width; ++x) {
+            usize index = (usize)y * size.width + x;
+            bool  kept  = y < rows && x < label_width;
+            u32   ch    = kept && x < strlen(label) ? (u32)label[x] : ' ';
+            TEST_ASSERT_EQ(TERM_FB_CH(index), ch);
+            TEST_ASSERT_EQ(TERM_FB_PAPER(index),
+                           kept ? term_test_row_paper(y)
+                                : term_rgb(0, 0, 0));
+        }
+        TEST_ASSERT_EQ(g_term_fb_dirty_x0[y], 0);
+        TEST_ASSERT_EQ(g_term_fb_dirty_x1[y], size.width);
+    }
+}
+
+TEST_CASE(fb, resizing_keeps_the_contents)
+{
+    _term_fb_resize(40, 8);
+    for (u16 y = 0; y < 8; ++y) {
+        term_fb_rect_colour((TermRect){0, y, 40, 1},
+                            term_rgb(255, 255, 255),
+                            term_test_row_paper(y));
+        char label[16];
+        snprintf(label, sizeof(label), "row %u", y);
+        term_fb_write(0, y, label);
+    }
+    term_test_check_fb(8, 40);
+
+    // Narrower, then wider within the same memory so that rows move towards
+    // the end to make room, then wider and taller still.
+    _term_fb_resize(20, 8);
+    term_test_check_fb(8, 20);
+    _term_fb_resize(30, 9);
+    term_test_check_fb(8, 20);
+    _term_fb_resize(50, 12);
+    term_test_check_fb(8, 20);
+    _term_fb_resize(4, 6);
+    term_test_check_fb(6, 4);
+
+    _term_fb_done();
+}
+
+//------------------------------------------------------------------------------
+// Event queue
+
+internal void term_test_queue_key(u32 code)
+{
+    _term_queue_event((TermEvent){.kind = TERM_EVENT_KEY, .code = code});
+}
+
+TEST_CASE(events, queue_grows_and_keeps_order)
+{
+    TermEventQueue* queue = &g_term.event_queue;
+    while (term_poll_event().kind != TERM_EVENT_NONE) {
+    }
+
+    // The first event allocates the queue.
+    term_test_queue_key(0);
+    TEST_ASSERT_EQ(term_poll_event().code, 0);
+
+    // Move the head along, then queue enough to wrap around and grow twice.
+    u32 capacity = queue->capacity;
+    u32 next     = 0;
+    u32 expected = 0;
+    for (; next < capacity / 2; ++next) {
+        term_test_queue_key(next);
+    }
+    for (; expected < capacity / 4; ++expected) {
+        TEST_ASSERT_EQ(term_poll_event().code, expected);
+    }
+    TEST_ASSERT_GT(queue->head, 0);
+    for (; next < capacity * 3; ++next) {
+        term_test_queue_key(next);
+    }
+    TEST_ASSERT_EQ(queue->capacity, capacity * 4);
+    TEST_ASSERT_EQ(queue->count, next - expected);
+
+    // Polled in batches that do not divide the queue evenly.
+    TermEvent events[5];
+    usize     count;
+    while ((count = term_poll_events(events, 5)) > 0) {
+        for (usize i = 0; i < count; ++i) {
+            TEST_ASSERT_EQ(events[i].code, expected++);
+        }
+    }
+    TEST_ASSERT_EQ(expected, next);
+    TEST_ASSERT_EQ(queue->count, 0);
+}
+
+//------------------------------------------------------------------------------
+// Input decoding
+//
+// The terminal is not started, so bytes are fed to the decoder as if they had
+// been read from it.
+
+internal void term_test_input(cstr bytes)
+{
+    _term_input_decode((const u8*)bytes, strlen(bytes));
+}
+
+internal void term_test_key(u32 code, u8 modifiers)
+{
+    TermEvent event = term_poll_event();
+    TEST_ASSERT_EQ(event.kind, TERM_EVENT_KEY);
+    TEST_ASSERT_EQ(event.code, code);
+    TEST_ASSERT_EQ(event.modifiers, modifiers);
+}
+
+internal void term_test_mouse(TermMouseAction action,
+                              TermMouseButton button,
+                              u16             x,
+                              u16             y,
+                              u8              modifiers)
+{
+    TermEvent event = term_poll_event();
+    TEST_ASSERT_EQ(event.kind, TERM_EVENT_MOUSE);
+    TEST_ASSERT_EQ(event.mouse.action, action);
+    TEST_ASSERT_EQ(event.mouse.button, button);
+    TEST_ASSERT_EQ(event.mouse.x, x);
+    TEST_ASSERT_EQ(event.mouse.y, y);
+    TEST_ASSERT_EQ(event.mouse.modifiers, modifiers);
+}
+
+internal void term_test_no_events(void)
+{
+    TEST_ASSERT_EQ(term_poll_event().kind, TERM_EVENT_NONE);
+}
+
+// Starts each test with an idle decoder and no events.
+internal void term_test_input_start(void)
+{
+    g_term_input = (TermInputDecoder){0};
+    while (term_poll_event().kind != TERM_EVENT_NONE) {
+    }
+}
+
+TEST_CASE(input, keys)
+{
+    term_test_input_start();
+
+    term_test_input("a\x01\r\x7f");
+    TermEvent event = term_poll_event();
+    TEST_ASSERT_EQ(event.kind, TERM_EVENT_KEY);
+    TEST_ASSERT_EQ(event.key, 'a');
+    TEST_ASSERT_EQ(event.code, 'a');
+    TEST_ASSERT_EQ(event.modifiers, 0);
+    event = term_poll_event();
+    TEST_ASSERT_EQ(event.key, 0x01);
+    TEST_ASSERT_EQ(event.code, 'a');
+    TEST_ASSERT_EQ(event.modifiers, TERM_MOD_CTRL);
+    term_test_key(TERM_KEY_ENTER, 0);
+    term_test_key(TERM_KEY_BACKSPACE, 0);
+
+    // CSI and SS3 keys, with modifiers.
+    term_test_input("\x1b[A\x1b[1;5C\x1bOP\x1b[3~\x1b[15;2~\x1b[Z\x1b[1;4H");
+    term_test_key(TERM_KEY_UP, 0);
+    term_test_key(TERM_KEY_RIGHT, TERM_MOD_CTRL);
+    term_test_key(TERM_KEY_F1, 0);
+    term_test_key(TERM_KEY_DELETE, 0);
+    term_test_key(TERM_KEY_F5, TERM_MOD_SHIFT);
+    term_test_key(TERM_KEY_TAB, TERM_MOD_SHIFT);
+    term_test_key(TERM_KEY_HOME, TERM_MOD_SHIFT | TERM_MOD_ALT);
+
+    // ESC before a key is Alt, but before another ESC is the Escape key.
+    // Unknown sequences are ignored.
+    term_test_input("\x1bx\x1b[99~\x1b[?1;2c\x1b\x1b[B");
+    term_test_key('x', TERM_MOD_ALT);
+    term_test_key(TERM_KEY_ESCAPE, 0);
+    term_test_key(TERM_KEY_DOWN, 0);
+    term_test_no_events();
+
+    // UTF-8, with invalid bytes replaced.
+    term_test_input("é日😀\xff\xe6z");
+    term_test_key(0xE9, 0);
+    term_test_key(0x65E5, 0);
+    term_test_key(0x1F600, 0);
+    term_test_key(0xFFFD, 0);
+    term_test_key(0xFFFD, 0);
+    term_test_key('z', 0);
+    term_test_no_events();
+}
+
+TEST_CASE(input, sequences_split_across_reads)
+{
+    term_test_input_start();
+
+    // A CSI split part way through a parameter.
+    term_test_input("\x1b[1");
+    term_test_input(";");
+    term_test_input("5");
+    term_test_no_events();
+    term_test_input("D");
+    term_test_key(TERM_KEY_LEFT, TERM_MOD_CTRL);
+
+    term_test_input("\xe6\x97");
+    term_test_no_events();
+    term_test_input("\xa5");
+    term_test_key(0x65E5, 0);
+
+    // ESC on its own is only the Escape key once no more input follows it.
+    term_test_input("\x1b");
+    term_test_no_events();
+    term_test_input("[A");
+    term_test_key(TERM_KEY_UP, 0);
+    term_test_input("\x1b");
+    _term_input_flush();
+    term_test_key(TERM_KEY_ESCAPE, 0);
+    term_test_no_events();
+}
+
+#if KORE_OS_POSIX
+TEST_CASE(input, escape_waits_for_the_rest_of_a_sequence)
+{
+    term_test_input_start();
+
+    // Input is read from a pipe standing in for the terminal.  An earlier
+    // test may have left the terminal marked headless, which reads nothing.
+    g_term.headless = false;
+    int fds[2];
+    TEST_ASSERT_EQ(pipe(fds), 0);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    int saved_stdin = dup(STDIN_FILENO);
+    dup2(fds[0], STDIN_FILENO);
+
+    // A read that ends on the ESC of a sequence waits for the rest of it.
+    TEST_ASSERT_EQ(write(fds[1], "\x1b", 1), 1);
+    TEST_ASSERT(!term_wait(0));
+    TEST_ASSERT(!term_wait(0));
+    TEST_ASSERT_EQ(write(fds[1], "[A", 2), 2);
+    TEST_ASSERT(term_wait(0));
+    term_test_key(TERM_KEY_UP, 0);
+    term_test_no_events();
+
+    // On its own, it is the Escape key once nothing has followed it for a
+    // moment, which ends a longer wait.
+    TEST_ASSERT_EQ(write(fds[1], "\x1b", 1), 1);
+    TEST_ASSERT(!term_wait(0));
+    TimePoint start = time_now();
+    TEST_ASSERT(term_wait(time_from_secs(5)));
+    TEST_ASSERT_LT(time_duration_to_ms(time_elapsed(start, time_now())), 1000);
+    term_test_key(TERM_KEY_ESCAPE, 0);
+    term_test_no_events();
+
+    dup2(saved_stdin, STDIN_FILENO);
+    close(saved_stdin);
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif
+
+TEST_CASE(input, mouse)
+{
+    term_test_input_start();
+
+    term_test_input("\x1b[<0;10;5M");
+    term_test_mouse(TERM_MOUSE_PRESS, TERM_MOUSE_LEFT, 9, 4, 0);
+
+    // Consecutive drags are coalesced into the last.
+    term_test_input("\x1b[<32;11;5M\x1b[<32;12;6M");
+    term_test_input("\x1b[<32;13;6M");
+    term_test_mouse(TERM_MOUSE_MOVE, TERM_MOUSE_LEFT, 12, 5, 0);
+    term_test_no_events();
+
+    // Unless something happened in between.
+    term_test_input("\x1b[<32;13;6Mk\x1b[<32;14;6M\x1b[<0;14;6m");
+    term_test_mouse(TERM_MOUSE_MOVE, TERM_MOUSE_LEFT, 12, 5, 0);
+    term_test_key('k', 0);
+    term_test_mouse(TERM_MOUSE_MOVE, TERM_MOUSE_LEFT, 13, 5, 0);
+    term_test_mouse(TERM_MOUSE_RELEASE, TERM_MOUSE_LEFT, 13, 5, 0);
+
+    term_test_input("\x1b[<65;1;1M\x1b[<18;3;2M");
+    term_test_mouse(TERM_MOUSE_WHEEL, TERM_MOUSE_WHEEL_DOWN, 0, 0, 0);
+    term_test_mouse(
+        TERM_MOUSE_PRESS, TERM_MOUSE_RIGHT, 2, 1, TERM_MOD_CTRL);
+    term_test_no_events();
+}
+
+TEST_CASE(input, bracketed_paste)
+{
+    term_test_input_start();
+
+    // The end marker split across two reads.
+    term_test_input("\x1b[200~hello \x1b[20");
+    term_test_no_events();
+    term_test_input("1~x");
+    TermEvent event = term_poll_event();
+    TEST_ASSERT_EQ(event.kind, TERM_EVENT_PASTE);
+    TEST_ASSERT_EQ(event.paste.length, 6);
+    TEST_ASSERT(memcmp(event.paste.text, "hello ", 6) == 0);
+    term_test_key('x', 0);
+
+    // Escape sequences within the text are kept as they are.
+    term_test_input("\x1b[200~a\x1b[2b\x1b\x1b[201~");
+    event = term_poll_event();
+    TEST_ASSERT_EQ(event.kind, TERM_EVENT_PASTE);
+    TEST_ASSERT_EQ(event.paste.length, 6);
+    TEST_ASSERT(memcmp(event.paste.text, "a\x1b[2b\x1b", 6) == 0);
+    term_test_no_events();
+}
+
+TEST_CASE(input, rep_probe_reply)
+{
+    term_test_input_start();
+    g_term.rep       = false;
+    g_term.rep_probe = true;
+
+    // Modified F3 keys look like cursor position reports on the first row.
+    term_test_input("\x1b[1;2R\x1b[1;3R");
+    term_test_key(TERM_KEY_F3, TERM_MOD_SHIFT);
+    term_test_key(TERM_KEY_F3, TERM_MOD_ALT);
+    TEST_ASSERT(g_term.rep_probe);
+    TEST_ASSERT(!g_term.rep);
+
+    term_test_input("\x1b[2;3R");
+    term_test_no_events();
+    TEST_ASSERT(!g_term.rep_probe);
+    TEST_ASSERT(g_term.rep);
+
+    // Once the probe is answered, further reports are keys again.
+    term_test_input("\x1b[2;2R");
+    term_test_key(TERM_KEY_F3, TERM_MOD_SHIFT);
+    TEST_ASSERT(g_term.rep);
+    g_term.rep = false;
+}
+
+//------------------------------------------------------------------------------
+// Character widths
+
+TEST_CASE(width, known_characters)
+{
+    TEST_ASSERT_EQ(term_char_width('a'), 1);
+    TEST_ASSERT_EQ(term_char_width(0x0301), 0);  // Combining acute accent
+    TEST_ASSERT_EQ(term_char_width(0x65E5), 2);  // 日
+    TEST_ASSERT_EQ(term_char_width(0x1F600), 2); // Grinning face
+    TEST_ASSERT_EQ(term_char_width(0x00AD), 1);  // Soft hyphen
+    TEST_ASSERT_EQ(term_char_width(0x1160), 0);  // Hangul jungseong filler
+
+    TEST_ASSERT_EQ(term_char_width(0x07), -1);
+    TEST_ASSERT_EQ(term_char_width(0x7F), -1);
+    TEST_ASSERT_EQ(term_char_width(0x9B), -1);
+
+    // Unassigned code points in the ideographic planes are wide.
+    TEST_ASSERT_EQ(term_char_width(0x2FFFD), 2);
+}
+
+//------------------------------------------------------------------------------
+// Canvases
+
+TEST_CASE(canvas, blit_is_clipped)
+{
+    Arena arena;
+    arena_init(&arena);
+    term_init(.headless_size = {10, 4});
+    term_fb_cls(term_rgb(255, 255, 255), 0);
+
+    TermCanvas canvas;
+    term_canvas_init(&canvas, &arena, 6, 3);
+    term_canvas_cls(&canvas, term_rgb(0, 255, 0), term_rgb(0, 0, 255));
+    term_canvas_write(&canvas, 0, 0, "abcdef\n日本");
+    term_canvas_rect(&canvas, (TermRect){5, 2, 9, 9}, '#', 0, 0);
+
+    // Only the columns 2-3 and rows 1-2 of the canvas fit.
+    term_fb_blit(&canvas, (TermRect){2, 1, 100, 100}, 8, 2);
+    term_fb_present();
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+    TEST_ASSERT_EQ(term_headless_cell(7, 2).paper, 0);
+    TEST_ASSERT_EQ(term_headless_cell(8, 2).ch, 0x672C);
+    TEST_ASSERT_EQ(term_headless_cell(9, 2).ch, TERM_HEADLESS_WIDE_TAIL);
+    TEST_ASSERT_EQ(term_headless_cell(8, 2).paper, 0x0000FF);
+    TEST_ASSERT_EQ(term_headless_cell(8, 3).ch, ' ');
+    TEST_ASSERT_EQ(term_headless_cell(9, 3).paper, 0x0000FF);
+
+    term_fb_blit(&canvas, (TermRect){0, 0, 6, 2}, 0, 0);
+    term_fb_present();
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+    TEST_ASSERT_EQ(term_headless_cell(5, 0).ch, 'f');
+    TEST_ASSERT_EQ(term_headless_cell(0, 1).ch, 0x65E5);
+    TEST_ASSERT_EQ(term_headless_cell(1, 1).ch, TERM_HEADLESS_WIDE_TAIL);
+    TEST_ASSERT_EQ(term_headless_cell(2, 1).ch, 0x672C);
+
+    // Off the framebuffer entirely.
+    term_fb_blit(&canvas, (TermRect){0, 0, 6, 3}, 10, 0);
+    term_fb_blit(&canvas, (TermRect){6, 0, 6, 3}, 0, 0);
+
+    term_test_stop();
+    arena_done(&arena);
+}
+
+TEST_CASE(canvas, unchanged_blit_stays_clean)
+{
+    Arena arena;
+    arena_init(&arena);
+    term_init(.headless_size = {40, 10});
+
+    TermCanvas canvas;
+    term_canvas_init(&canvas, &arena, 20, 5);
+    term_canvas_cls(&canvas, term_rgb(200, 200, 200), term_rgb(20, 20, 20));
+    term_canvas_format(&canvas, 1, 1, "CPU %d%%", 42);
+
+    term_fb_blit(&canvas, (TermRect){0, 0, 20, 5}, 10, 2);
+    term_fb_present();
+    TEST_ASSERT_GT(term_stats().frame_bytes, 0);
+
+    // Compositing the same panel again sends nothing.
+    term_fb_blit(&canvas, (TermRect){0, 0, 20, 5}, 10, 2);
+    term_fb_present();
+    TEST_ASSERT_EQ(term_stats().dirty_cells, 0);
+    TEST_ASSERT_EQ(term_stats().frame_bytes, 0);
+
+    // Only the changed row is sent.
+    term_canvas_format(&canvas, 1, 1, "CPU %d%%", 43);
+    term_fb_blit(&canvas, (TermRect){0, 0, 20, 5}, 10, 2);
+    term_fb_present();
+    TEST_ASSERT_EQ(term_stats().dirty_cells, 20);
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+
+    term_test_stop();
+    arena_done(&arena);
+}
+
+TEST_CASE(canvas, half_blocks)
+{
+    Arena arena;
+    arena_init(&arena);
+    TermCanvas canvas;
+    term_canvas_init(&canvas, &arena, 40, 6);
+    term_canvas_cls(&canvas, 0, term_rgb(1, 2, 3));
+
+    // A random image, with some pixels matching the one above.
+    u32 pixels[37 * 9];
+    random_seed(3);
+    for (usize i = 0; i < 37 * 9; ++i) {
+        pixels[i] = i >= 37 && random_range_u64(0, 2) == 0 ? pixels[i - 37]
+                                                           : term_test_colour();
+    }
+    term_canvas_half_blocks(
+        &canvas, 2, 1, (TermPixels){pixels, 37, 9, 0, TERM_PIXELS_ARGB});
+
+    for (u16 y = 0; y < 5; ++y) {
+        for (u16 x = 0; x < 37; ++x) {
+            usize i      = (usize)(y + 1) * canvas.width + x + 2;
+            u32   top    = pixels[y * 2 * 37 + x];
+            u32   bottom = y < 4 ? pixels[(y * 2 + 1) * 37 + x]
+                                 : term_rgb(1, 2, 3);
+            TEST_ASSERT_EQ(canvas.ink[i], top);
+            TEST_ASSERT_EQ(canvas.paper[i], bottom);
+            TEST_ASSERT_EQ(canvas.chars[i], top == bottom ? ' ' : 0x2580);
+        }
+    }
+
+    // Bytes R, G, B, A in memory, clipped on the right.
+    u8 rgba[] = {10, 20, 30, 255, 10, 20, 30, 255, 10, 20, 30, 255, 1, 2, 3, 4};
+    u32 image[4];
+    memcpy(image, rgba, sizeof(rgba));
+    term_canvas_half_blocks(
+        &canvas, 39, 0, (TermPixels){image, 2, 2, 2, TERM_PIXELS_RGBA});
+    TEST_ASSERT_EQ(canvas.ink[39], term_rgb(10, 20, 30));
+    TEST_ASSERT_EQ(canvas.paper[39], term_rgb(10, 20, 30));
+    TEST_ASSERT_EQ(canvas.chars[39], ' ');
+
+    arena_done(&arena);
+}
+
+TEST_CASE(canvas, braille)
+{
+    Arena arena;
+    arena_init(&arena);
+    TermCanvas canvas;
+    term_canvas_init(&canvas, &arena, 12, 3);
+
+    // A diagonal line across 19x9 pixels.
+    u32 pixels[9][19] = {0};
+    for (u16 x = 0; x < 19; ++x) {
+        pixels[x * 9 / 19][x] = term_rgb(255, 255, 255);
+    }
+    u32 ink   = term_rgb(0, 255, 0);
+    u32 paper = term_rgb(0, 0, 0);
+    TermPixels image = {.pixels = &pixels[0][0], .width = 19, .height = 9};
+    term_canvas_braille(&canvas, 1, 0, image, ink, paper);
+
+    for (u16 y = 0; y < 3; ++y) {
+        for (u16 x = 0; x < 10; ++x) {
+            static const u8 dots[4][2] = {
+                {0x01, 0x08}, {0x02, 0x10}, {0x04, 0x20}, {0x40, 0x80}};
+            u32 pattern = 0;
+            for (u16 dy = 0; dy < 4 && y * 4 + dy < 9; ++dy) {
+                for (u16 dx = 0; dx < 2 && x * 2 + dx < 19; ++dx) {
+                    if (pixels[y * 4 + dy][x * 2 + dx]) {
+                        pattern |= dots[dy][dx];
+                    }
+                }
+            }
+
+            usize i = (usize)y * canvas.width + x + 1;
+            TEST_ASSERT_EQ(canvas.chars[i], pattern ? 0x2800 + pattern : ' ');
+            TEST_ASSERT_EQ(canvas.ink[i], ink);
+        }
+    }
+
+    arena_done(&arena);
+}
+
+//------------------------------------------------------------------------------
+// Translucent colours
+
+// Blends two colours the long way round, for comparison.
+internal u32 term_test_blend(u32 dst, u32 src)
+{
+    u32 alpha = src >> 24;
+    u32 out   = 0;
+    for (u32 shift = 0; shift < 24; shift += 8) {
+        u32 s = (src >> shift) & 0xFF;
+        u32 d = (dst >> shift) & 0xFF;
+        out |= (2 * (s * alpha + d * (255 - alpha)) + 255) / 510 << shift;
+    }
+    return out;
+}
+
+TEST_CASE(blend, rect_matches_reference)
+{
+    term_init(.headless_size = {40, 6});
+    random_seed(5);
+    for (u16 y = 0; y < 6; ++y) {
+        for (u16 x = 0; x < 40; ++x) {
+            term_fb_rect((TermRect){x, y, 1, 1},
+                         'a' + x % 26,
+                         term_test_colour(),
+                         term_test_colour());
+        }
+    }
+    term_fb_present();
+
+    TermHeadlessCell before[6][40];
+    for (u16 y = 0; y < 6; ++y) {
+        for (u16 x = 0; x < 40; ++x) {
+            before[y][x] = term_headless_cell(x, y);
+        }
+    }
+
+    // Widths that are not a multiple of the SIMD lanes, one rectangle clipped,
+    // one fully transparent and some wholly off the screen.
+    u32 colour = term_rgba(200, 100, 50, 77);
+    u32 shade  = term_rgba(0, 0, 0, 128);
+    term_fb_rect_blend((TermRect){3, 1, 13, 2}, colour);
+    term_fb_blend_paper((TermRect){30, 0, 20, 9}, shade);
+    term_fb_rect_blend((TermRect){0, 5, 40, 1}, term_rgba(1, 2, 3, 0));
+    term_fb_rect_blend((TermRect){60, 2, 5, 2}, colour);
+    term_fb_blend_paper((TermRect){0, 6, 40, 2}, shade);
+    term_fb_rect_blend((TermRect){65530, 65530, 10, 10}, colour);
+    term_fb_present();
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+
+    for (u16 y = 0; y < 6; ++y) {
+        for (u16 x = 0; x < 40; ++x) {
+            TermHeadlessCell was   = before[y][x];
+            TermHeadlessCell cell  = term_headless_cell(x, y);
+            u32              ink   = was.ink;
+            u32              paper = was.paper;
+            if (x >= 3 && x < 16 && y >= 1 && y < 3) {
+                ink   = term_test_blend(ink, colour);
+                paper = term_test_blend(paper, colour);
+            }
+            if (x >= 30) {
+                paper = term_test_blend(paper, shade);
+            }
+            TEST_ASSERT_EQ(cell.ch, was.ch);
+            TEST_ASSERT_EQ(cell.ink, ink);
+            TEST_ASSERT_EQ(cell.paper, paper);
+        }
+    }
+
+    term_test_stop();
+}
+
+TEST_CASE(blend, canvas_over_framebuffer)
+{
+    Arena arena;
+    arena_init(&arena);
+    term_init(.headless_size = {20, 4});
+    u32 ink   = term_rgb(200, 200, 200);
+    u32 paper = term_rgb(0, 0, 100);
+    term_fb_cls(ink, paper);
+    term_fb_rect((TermRect){0, 0, 20, 4}, 'x', ink, paper);
+
+    // A popup with a translucent body and opaque text, in a canvas that is
+    // otherwise untouched.
+    TermCanvas canvas;
+    term_canvas_init(&canvas, &arena, 13, 3);
+    u32 body = term_rgba(255, 255, 0, 96);
+    u32 text = term_rgb(255, 0, 0);
+    term_canvas_rect_colour(&canvas, (TermRect){1, 0, 11, 2}, text, body);
+    term_canvas_write(&canvas, 2, 1, "ok");
+
+    term_fb_blit_blend(&canvas, (TermRect){0, 0, 13, 3}, 4, 1);
+    term_fb_present();
+    TEST_ASSERT_EQ(term_headless_verify(), 0);
+
+    for (u16 y = 0; y < 4; ++y) {
+        for (u16 x = 0; x < 20; ++x) {
+            TermHeadlessCell cell  = term_headless_cell(x, y);
+            bool             popup = x >= 5 && x < 16 && y >= 1 && y < 3;
+            bool             word  = y == 2 && (x == 6 || x == 7);
+            TEST_ASSERT_EQ(cell.ch, word ? (x == 6 ? 'o' : 'k') : 'x');
+            TEST_ASSERT_EQ(cell.ink,
+                           word    ? text & 0xFFFFFF
+                           : popup ? term_test_blend(ink, body)
+                                   : ink & 0xFFFFFF);
+            TEST_ASSERT_EQ(cell.paper,
+                           popup ? term_test_blend(paper, body)
+                                 : paper & 0xFFFFFF);
+        }
+    }
+
+    term_test_stop();
+    arena_done(&arena);
+}
+
+//------------------------------------------------------------------------------
+// Frame pacing
+
+TEST_CASE(pacing, frames_keep_to_the_rate)
+{
+    TermSize size = {40, 10};
+    term_init(.headless_size = size, .frame_rate = 100);
+    random_seed(14);
+
+    // The first frame is due at once, and handles the first resize event.
+    TEST_ASSERT(term_frame_begin());
+    TEST_ASSERT_EQ(term_poll_event().kind, TERM_EVENT_RESIZE);
+    term_frame_end();
+
+    TimePoint start = time_now();
+    for (u32 frame = 0; frame < 10; ++frame) {
+        TEST_ASSERT(!term_frame_begin());
+        term_test_draw(size);
+        term_frame_end();
+    }
+    TimeDuration elapsed = time_elapsed(start, time_now());
+
+    // Each frame is at least 10ms after the last.  A slow present may have
+    // spaced them out further, but never beyond the target.
+    TEST_ASSERT_GE(time_duration_to_ms(elapsed), 100);
+    TEST_ASSERT(term_stats().frame_rate > 0.0);
+    TEST_ASSERT(term_stats().frame_rate < 100.5);
+    TEST_ASSERT_EQ(term_stats().output_backlog, 0);
+    term_test_stop();
+
+    // Events are handled without waiting a second for the next frame.
+    term_init(.headless_size = size, .frame_rate = 1);
+    term_frame_begin();
+    term_poll_event();
+    term_frame_end();
+    start = time_now();
+    term_headless_resize((TermSize){30, 8});
+    TEST_ASSERT(term_frame_begin());
+    TEST_ASSERT_LT(time_duration_to_ms(time_elapsed(start, time_now())), 500);
+    TEST_ASSERT_EQ(term_poll_event().kind, TERM_EVENT_RESIZE);
+    term_frame_end();
+    term_test_stop();
+}
+
+TEST_CASE(pacing, slow_frames_lower_the_rate)
+{
+    // Presenting these takes far longer than a frame at 10000 frames/s.
+    TermSize size = {400, 150};
+    term_init(.headless_size = size, .frame_rate = 10000);
+    term_poll_event();
+    random_seed(15);
+
+    char line[401] = {0};
+    for (u32 frame = 0; frame < 8; ++frame) {
+        term_frame_begin();
+        for (u16 y = 0; y < size.height; ++y) {
+            for (u16 x = 0; x < size.width; ++x) {
+                line[x] = (char)('a' + (x * 7 + y + frame) % 26);
+            }
+            term_fb_rect_colour((TermRect){0, y, size.width, 1},
+                                term_test_colour(),
+                                term_test_colour());
+            term_fb_write(0, y, line);
+        }
+        term_frame_end();
+    }
+    f64 slow_rate = term_stats().frame_rate;
+    TEST_ASSERT(slow_rate < 5000.0);
+
+    // Once frames are cheap again the rate recovers.
+    for (u32 frame = 0; frame < 8; ++frame) {
+        term_frame_begin();
+        term_frame_end();
+    }
+    TEST_ASSERT(term_stats().frame_rate > slow_rate);
+    term_test_stop();
+}
+
+//------------------------------------------------------------------------------
+// Broadcasting
+
+#if KORE_OS_POSIX
+
+internal int term_test_connect(cstr path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    TEST_ASSERT_EQ(
+        connect(fd, (struct sockaddr*)&address, sizeof(address)), 0);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// Appends everything a client has been sent so far to its stream.  Returns
+// the number of bytes read.
+internal usize term_test_receive(int fd, Array(u8)* stream)
+{
+    usize total = 0;
+    for (;;) {
+        u8      buffer[65536];
+        ssize_t bytes = read(fd, buffer, sizeof(buffer));
+        if (bytes <= 0) {
+            return total;
+        }
+        usize count = array_count(*stream);
+        array_reserve(*stream, count + (usize)bytes);
+        memcpy(*stream + count, buffer, (usize)bytes);
+        total += (usize)bytes;
+    }
+}
+
+// Presents until a client has been sent everything waiting for it.
+internal void term_test_catch_up(int fd, Array(u8)* stream)
+{
+    for (u32 quiet = 0; quiet < 2;) {
+        term_fb_present();
+        quiet = term_test_receive(fd, stream) == 0 ? quiet + 1 : 0;
+    }
+}
+
+internal usize term_test_replay(Array(u8) stream)
+{
+    term_headless_replay(string_from(stream, array_count(stream)));
+    return term_headless_verify();
+}
+
+TEST_CASE(broadcast, clients_follow_the_screen)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/term_test_%d.sock", (int)getpid());
+    TermSize size = {60, 20};
+    term_init(.headless_size = size, .broadcast_path = path);
+    u64 keyframes = term_stats().keyframes;
+    random_seed(11);
+    term_fb_cls(term_test_colour(), term_test_colour());
+    term_fb_present();
+
+    // One client watches from early on and the other joins part way.
+    Array(u8) early_stream = NULL;
+    Array(u8) late_stream  = NULL;
+    int       early        = term_test_connect(path);
+    for (u32 frame = 0; frame < 40; ++frame) {
+        term_test_draw(size);
+        term_fb_present();
+        term_test_receive(early, &early_stream);
+    }
+    int late = term_test_connect(path);
+    for (u32 frame = 0; frame < 40; ++frame) {
+        term_test_draw(size);
+        term_fb_present();
+    }
+    term_test_catch_up(early, &early_stream);
+    term_test_catch_up(late, &late_stream);
+
+    TEST_ASSERT_EQ(term_stats().clients, 2);
+    TEST_ASSERT_EQ(term_stats().keyframes - keyframes, 2);
+    TEST_ASSERT_EQ(term_test_replay(early_stream), 0);
+    TEST_ASSERT_EQ(term_test_replay(late_stream), 0);
+
+    // Clients that go are forgotten.
+    close(early);
+    close(late);
+    term_fb_present();
+    TEST_ASSERT_EQ(term_stats().clients, 0);
+
+    array_free(early_stream);
+    array_free(late_stream);
+    term_test_stop();
+    TEST_ASSERT(access(path, F_OK) != 0);
+}
+
+TEST_CASE(broadcast, lagging_client_is_sent_the_screen)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/term_test_%d.sock", (int)getpid());
+    TermSize size = {200, 90};
+    term_init(.headless_size = size, .broadcast_path = path);
+    u64 keyframes = term_stats().keyframes;
+    int fd        = term_test_connect(path);
+
+    // Each frame repaints different rows in random colours, so a frame that
+    // is missed leaves rows wrong.  Together they are far more than the
+    // socket can hold.
+    random_seed(12);
+    for (u16 y = 0; y < size.height; ++y) {
+        for (u16 x = 0; x < size.width; ++x) {
+            term_fb_rect((TermRect){x, y, 1, 1},
+                         'a' + (x + y) % 26,
+                         term_test_colour(),
+                         term_test_colour());
+        }
+        if (y % 3 == 2) {
+            term_fb_present();
+        }
+    }
+
+    Array(u8) stream = NULL;
+    term_test_catch_up(fd, &stream);
+    TEST_ASSERT_GT(term_stats().keyframes - keyframes, 1);
+    TEST_ASSERT_EQ(term_test_replay(stream), 0);
+
+    close(fd);
+    array_free(stream);
+    term_test_stop();
+}
+
+#endif // KORE_OS_POSIX
+
+//------------------------------------------------------------------------------
+// Recordings
+
+#define TERM_TEST_RECORD(...)                                                  \
+    string_from((u8[]){__VA_ARGS__}, sizeof((u8[]){__VA_ARGS__}))
+
+TEST_CASE(record, reader_checks_the_data)
+{
+    TermRecordReader reader;
+    TermRecord       record;
+    TEST_ASSERT(!term_record_reader_init(&reader, TERM_TEST_RECORD('T')));
+    TEST_ASSERT(!term_record_reader_init(
+        &reader, TERM_TEST_RECORD('T', 'E', 'R', 'M', 'R', 'E', 'C', 2)));
+
+    // A frame at 5us, a keyframe at 5us, a frame at 133us and a record of an
+    // unknown kind.
+    string data = TERM_TEST_RECORD('T', 'E', 'R', 'M', 'R', 'E', 'C', 1, 1, 5,
+                                   3, 'a', 'b', 'c', 2, 0, 4, 50, 16, 'x', 'y',
+                                   1, 0x80, 0x01, 2, 'z', 'z', 7);
+    TEST_ASSERT(term_record_reader_init(&reader, data));
+
+    TEST_ASSERT(term_record_next(&reader, &record));
+    TEST_ASSERT_EQ(record.kind, TERM_RECORD_FRAME);
+    TEST_ASSERT_EQ(record.time_us, 5);
+    TEST_ASSERT_EQ(record.output.count, 3);
+    TEST_ASSERT_EQ(record.output.data[2], 'c');
+
+    TEST_ASSERT(term_record_next(&reader, &record));
+    TEST_ASSERT_EQ(record.kind, TERM_RECORD_KEYFRAME);
+    TEST_ASSERT_EQ(record.time_us, 5);
+    TEST_ASSERT_EQ(record.size.width, 50);
+    TEST_ASSERT_EQ(record.size.height, 16);
+    TEST_ASSERT_EQ(record.output.count, 2);
+    TEST_ASSERT_EQ(record.output.data[0], 'x');
+
+    // A record that is cut short is not read until the rest of it arrives.
+    reader.data.count -= 2;
+    TEST_ASSERT(!term_record_next(&reader, &record));
+    reader.data.count += 1;
+    TEST_ASSERT(term_record_next(&reader, &record));
+    TEST_ASSERT_EQ(record.kind, TERM_RECORD_FRAME);
+    TEST_ASSERT_EQ(record.time_us, 133);
+    TEST_ASSERT_EQ(record.output.count, 2);
+
+    reader.data.count += 1;
+    TEST_ASSERT(!term_record_next(&reader, &record));
+}
+
+#if KORE_OS_POSIX
+
+internal Array(u8) term_test_load(cstr path)
+{
+    Array(u8) data = NULL;
+    FILE*     file = fopen(path, "rb");
+    TEST_ASSERT_NOT_NULL(file);
+    if (file) {
+        u8    buffer[65536];
+        usize bytes;
+        while ((bytes = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            usize count = array_count(data);
+            array_reserve(data, count + bytes);
+            memcpy(data + count, buffer, bytes);
+        }
+        fclose(file);
+    }
+    return data;
+}
+
+TEST_CASE(record, replays_from_any_keyframe)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/term_test_%d.rec", (int)getpid());
+    TermSize size = {50, 16};
+    term_init(.headless_size      = size,
+              .record_path        = path,
+              .record_keyframe_ms = 1);
+    u64 frame_count = term_stats().frame_count;
+    random_seed(13);
+    term_fb_cls(term_test_colour(), term_test_colour());
+    term_fb_present();
+    for (u32 frame = 0; frame < 40; ++frame) {
+        term_test_draw(size);
+        term_fb_present();
+        time_sleep_ms(2);
+    }
+
+    // Keyframes are written straight away, and as the last frame is followed
+    // by one, the whole recording can be read while it is still being made.
+    Array(u8)        data = term_test_load(path);
+    TermRecordReader reader;
+    TermRecord       record;
+    TEST_ASSERT(term_record_reader_init(
+        &reader, string_from(data, array_count(data))));
+
+    Array(u8)        frames    = NULL;
+    TermRecordReader middle    = reader;
+    string           keyframe  = {0};
+    u32              count     = 0;
+    u32              keyframes = 0;
+    u64              time_us   = 0;
+    while (term_record_next(&reader, &record)) {
+        TEST_ASSERT_GE(record.time_us, time_us);
+        time_us = record.time_us;
+        if (record.kind == TERM_RECORD_FRAME) {
+            usize bytes = array_count(frames);
+            array_reserve(frames, bytes + record.output.count);
+            memcpy(frames + bytes, record.output.data, record.output.count);
+            count += 1;
+        } else {
+            TEST_ASSERT_EQ(record.size.width, size.width);
+            TEST_ASSERT_EQ(record.size.height, size.height);
+            if (++keyframes == 20) {
+                middle   = reader;
+                keyframe = record.output;
+            }
+        }
+    }
+    TEST_ASSERT_EQ(count, term_stats().frame_count - frame_count);
+    TEST_ASSERT_GE(keyframes, count - 1);
+    TEST_ASSERT_EQ(reader.offset, array_count(data));
+    TEST_ASSERT_EQ(term_test_replay(frames), 0);
+
+    // The screen from a keyframe part way, with the frames after it.
+    array_clear(frames);
+    array_reserve(frames, keyframe.count);
+    memcpy(frames, keyframe.data, keyframe.count);
+    reader = middle;
+    while (term_record_next(&reader, &record)) {
+        if (record.kind == TERM_RECORD_FRAME) {
+            usize bytes = array_count(frames);
+            array_reserve(frames, bytes + record.output.count);
+            memcpy(frames + bytes, record.output.data, record.output.count);
+        }
+    }
+    TEST_ASSERT_EQ(term_test_replay(frames), 0);
+
+    array_free(frames);
+    array_free(data);
+    term_test_stop();
+    remove(path);
+}
+
+#endif // KORE_OS_POSIX
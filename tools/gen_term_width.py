@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+#-------------------------------------------------------------------------------
+# Generates include/term/term_width.h, the Unicode character width table used
+# by term_char_width().
+#
+# Usage: python3 tools/gen_term_width.py > include/term/term_width.h
+#
+# The widths come from the Unicode database built into Python, so rerun this
+# with a newer Python to pick up a newer version of Unicode.
+#-------------------------------------------------------------------------------
+
+import sys
+import unicodedata
+
+BLOCK_BITS = 8
+BLOCK_SIZE = 1 << BLOCK_BITS
+MAX_CODE_POINT = 0x110000
+
+# 2-bit width codes stored in the table.
+ZERO, NARROW, WIDE, CONTROL = 0, 1, 2, 3
+
+
+def width_code(cp):
+    if cp == 0:
+        return ZERO
+    if cp < 0x20 or 0x7F <= cp < 0xA0:
+        return CONTROL
+    if cp == 0x00AD:
+        return NARROW  # Soft hyphen is shown as a hyphen
+    if 0x1160 <= cp <= 0x11FF or cp == 0x200B:
+        return ZERO  # Hangul medial vowels and final consonants
+    category = unicodedata.category(chr(cp))
+    if category in ("Mn", "Me", "Cf"):
+        return ZERO
+    # Unassigned code points report a meaningless East Asian width.
+    if category != "Cn" and unicodedata.east_asian_width(chr(cp)) in ("W", "F"):
+        return WIDE
+    # Unassigned code points in the CJK ranges default to wide.
+    if (0x3400 <= cp <= 0x4DBF or 0x4E00 <= cp <= 0x9FFF or
+            0xF900 <= cp <= 0xFAFF or 0x20000 <= cp <= 0x2FFFD or
+            0x30000 <= cp <= 0x3FFFD):
+        return WIDE
+    return NARROW
+
+
+def main():
+    blocks = []
+    block_index = {}
+    stage1 = []
+    for start in range(0, MAX_CODE_POINT, BLOCK_SIZE):
+        packed = bytearray(BLOCK_SIZE // 4)
+        for offset in range(BLOCK_SIZE):
+            packed[offset >> 2] |= width_code(start + offset) << ((offset & 3) * 2)
+        packed = bytes(packed)
+        if packed not in block_index:
+            block_index[packed] = len(blocks)
+            blocks.append(packed)
+        stage1.append(block_index[packed])
+
+    assert len(blocks) <= 256
+
+    out = sys.stdout
+    out.write("//" + "-" * 78 + "\n")
+    out.write("// Unicode character widths (Unicode %s)\n" %
+              unicodedata.unidata_version)
+    out.write("//\n")
+    out.write("// Generated by tools/gen_term_width.py - do not edit.\n")
+    out.write("//" + "-" * 78 + "\n\n")
+    out.write("#pragma once\n\n")
+    out.write("#define TERM_WIDTH_BLOCK_BITS %d\n\n" % BLOCK_BITS)
+
+    out.write("// Block of each %d code points.\n" % BLOCK_SIZE)
+    out.write("global_variable const u8 g_term_width_stage1[%d] = {\n" % len(stage1))
+    for i in range(0, len(stage1), 16):
+        row = ", ".join("%3d" % v for v in stage1[i:i + 16])
+        out.write("    %s,\n" % row)
+    out.write("};\n\n")
+
+    out.write("// 2-bit width codes of each block, four code points per byte.\n")
+    out.write("global_variable const u8 g_term_width_stage2[%d] = {\n" %
+              (len(blocks) * len(blocks[0])))
+    for block in blocks:
+        for i in range(0, len(block), 12):
+            row = ", ".join("0x%02x" % v for v in block[i:i + 12])
+            out.write("    %s,\n" % row)
+    out.write("};\n")
+
+
+if __name__ == "__main__":
+    main()